@@ -0,0 +1,326 @@
+/*
+   Serial timing jitter benchmark.
+
+   RTU client port (through `mDownstream`, like in mbridge) is connected to the
+   slave side of pseudo-terminal. Responder thread on the master side answers
+   every 'Read Holding Registers' request at once and measures bus turnaround
+   gap: time from the end of the response to the first byte of the next
+   request. Upstream clients keep the queue full, so the gap is pure bridge
+   latency. Main loop is loaded with random busy work (like console output and
+   TCP parsing in mbridge) and the gap is measured twice: with client port in
+   main loop and with client port in dedicated (realtime) thread.
+
+   Usage: mbridge_jitter [-n <samples>] [-load <usec>] [-rt <priority>] [-cpu <n>]
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <ModbusClientPort.h>
+#include <ModbusSerialPort.h>
+
+#include "modbus/mclientconnector.h"
+#include "modbus/mdownstream.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options
+{
+    uint32_t samples;
+    uint32_t load   ; // max busy time of main loop iteration, microsec
+    int      rt     ;
+    int      cpu    ;
+
+    Options()
+    {
+        samples = 2000;
+        load    = 2000;
+        rt      = 0;
+        cpu     = -1;
+    }
+};
+
+Options options;
+
+enum
+{
+    Clients   = 8 ,
+    Registers = 10
+};
+
+static uint16_t crc16(const uint8_t *data, size_t size)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++)
+            crc = (crc & 1) ? static_cast<uint16_t>((crc >> 1) ^ 0xA001) : static_cast<uint16_t>(crc >> 1);
+    }
+    return crc;
+}
+
+/*
+   RTU slave on the master side of pseudo-terminal.
+*/
+class Responder
+{
+public:
+    Responder(int fd) : m_fd(fd), m_run(true), m_done(false), m_hasResponse(false)
+    {
+        m_gaps.reserve(options.samples);
+        m_thread = std::thread(&Responder::run, this);
+    }
+
+    ~Responder()
+    {
+        m_run = false;
+        m_thread.join();
+    }
+
+public:
+    inline bool isDone() const { return m_done; }
+    // Note: must be called after `isDone()` returns `true`
+    inline const std::vector<uint32_t> &gaps() const { return m_gaps; }
+
+private:
+    void run()
+    {
+        std::vector<uint8_t> buff;
+        Clock::time_point responseEnd;
+        Clock::time_point requestBegin;
+        while (m_run)
+        {
+            pollfd pfd;
+            pfd.fd = m_fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, 10) <= 0)
+                continue;
+            uint8_t chunk[256];
+            ssize_t n = read(m_fd, chunk, sizeof(chunk));
+            if (n <= 0) // Note: EIO while slave side is not opened
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            if (buff.empty())
+                requestBegin = Clock::now();
+            buff.insert(buff.end(), chunk, chunk + n);
+            if (buff.size() < 8) // 'Read Holding Registers' request size
+                continue;
+            if ((buff.size() > 8) || (buff[1] != MBF_READ_HOLDING_REGISTERS) ||
+                (crc16(buff.data(), 6) != (buff[6] | (buff[7] << 8))))
+            {
+                buff.clear();
+                continue;
+            }
+            if (m_hasResponse && !m_done)
+            {
+                m_gaps.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(requestBegin - responseEnd).count()));
+                if (m_gaps.size() >= options.samples)
+                    m_done = true;
+            }
+            uint16_t count = static_cast<uint16_t>((buff[4] << 8) | buff[5]);
+            if (count > Registers)
+            {
+                buff.clear();
+                continue;
+            }
+            uint8_t resp[5 + 2 * Registers];
+            size_t sz = 0;
+            resp[sz++] = buff[0];
+            resp[sz++] = MBF_READ_HOLDING_REGISTERS;
+            resp[sz++] = static_cast<uint8_t>(count * 2);
+            for (uint16_t i = 0; i < count; i++)
+            {
+                resp[sz++] = 0;
+                resp[sz++] = static_cast<uint8_t>(i);
+            }
+            uint16_t crc = crc16(resp, sz);
+            resp[sz++] = static_cast<uint8_t>(crc & 0xFF);
+            resp[sz++] = static_cast<uint8_t>(crc >> 8);
+            if (write(m_fd, resp, sz) != static_cast<ssize_t>(sz))
+                continue;
+            responseEnd = Clock::now();
+            m_hasResponse = true;
+            buff.clear();
+        }
+    }
+
+private:
+    int m_fd;
+    std::atomic<bool> m_run;
+    std::atomic<bool> m_done;
+    bool m_hasResponse;
+    std::vector<uint32_t> m_gaps;
+    std::thread m_thread;
+};
+
+static void busyWait(uint32_t usec)
+{
+    Clock::time_point end = Clock::now() + std::chrono::microseconds(usec);
+    while (Clock::now() < end)
+        ;
+}
+
+static void printResult(const char *title, std::vector<uint32_t> gaps)
+{
+    if (gaps.empty())
+    {
+        std::cout << title << ": no samples" << std::endl;
+        return;
+    }
+    std::sort(gaps.begin(), gaps.end());
+    double sum = 0;
+    for (uint32_t g : gaps)
+        sum += g;
+    double avg = sum / gaps.size();
+    double var = 0;
+    for (uint32_t g : gaps)
+        var += (g - avg) * (g - avg);
+    size_t n = gaps.size();
+    std::cout << title << " (turnaround gap, usec):" << std::endl <<
+                 "samples = " << n                                   << std::endl <<
+                 "min     = " << gaps.front()                        << std::endl <<
+                 "avg     = " << static_cast<uint32_t>(avg)          << std::endl <<
+                 "p50     = " << gaps[n / 2]                         << std::endl <<
+                 "p99     = " << gaps[(n * 99) / 100]                << std::endl <<
+                 "max     = " << gaps.back()                         << std::endl <<
+                 "stddev  = " << static_cast<uint32_t>(std::sqrt(var / n)) << std::endl << std::endl;
+}
+
+static bool measure(bool threaded, std::vector<uint32_t> *gaps)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0))
+    {
+        std::cout << "posix_openpt() failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    termios tio;
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+    std::string slave = ptsname(master);
+
+    const ModbusSerialPort::Defaults &d = ModbusSerialPort::Defaults::instance();
+    Modbus::SerialSettings ser;
+    ser.portName         = slave.c_str();
+    ser.baudRate         = d.baudRate;
+    ser.dataBits         = d.dataBits;
+    ser.parity           = d.parity;
+    ser.stopBits         = d.stopBits;
+    ser.flowControl      = d.flowControl;
+    ser.timeoutFirstByte = 1000;
+    ser.timeoutInterByte = 2;
+
+    // Note: like in mbridge client port in dedicated thread works in blocking mode
+    ModbusClientPort *cli = Modbus::createClientPort(Modbus::RTU, &ser, threaded);
+    mClientConnector *conn = new mClientConnector(cli);
+    mDownstream *down = new mDownstream(cli);
+    down->setConnector(conn);
+    down->setMaxQueue(Clients);
+    down->setMaxWait(0);
+    down->log()->attach(cli);
+
+    bool res = true;
+    std::string err;
+    if (threaded && !down->start(options.rt, options.cpu, &err))
+    {
+        std::cout << "Client thread error: " << err << std::endl;
+        res = false;
+    }
+    else
+    {
+        Responder responder(master);
+        ModbusObject clients[Clients];
+        uint16_t values[Registers];
+        uint32_t seed = 1;
+        while (!responder.isDone())
+        {
+            down->process();
+            for (ModbusObject &c : clients)
+                down->readHoldingRegisters(&c, 1, 0, Registers, values);
+            mPortLog::Record rec;
+            while (down->log()->pop(rec))
+                ;
+            // Note: simulates console output and request parsing of mbridge main loop
+            seed = seed * 1103515245 + 12345;
+            busyWait((seed >> 8) % (options.load + 1));
+            Modbus::msleep(1);
+        }
+        *gaps = responder.gaps();
+        down->stop();
+    }
+    delete down;
+    delete conn;
+    delete cli;
+    close(master);
+    return res;
+}
+
+static void parseOptions(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char *opt = argv[i];
+        if ((i + 1) < argc)
+        {
+            if (!strcmp(opt, "-n"))
+            {
+                options.samples = static_cast<uint32_t>(atoi(argv[++i]));
+                continue;
+            }
+            if (!strcmp(opt, "-load"))
+            {
+                options.load = static_cast<uint32_t>(atoi(argv[++i]));
+                continue;
+            }
+            if (!strcmp(opt, "-rt"))
+            {
+                options.rt = atoi(argv[++i]);
+                continue;
+            }
+            if (!strcmp(opt, "-cpu"))
+            {
+                options.cpu = atoi(argv[++i]);
+                continue;
+            }
+        }
+        printf("Usage: mbridge_jitter [-n <samples>] [-load <usec>] [-rt <priority>] [-cpu <n>]\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    parseOptions(argc, argv);
+    std::cout << "samples = " << options.samples << std::endl <<
+                 "load    = " << options.load    << std::endl <<
+                 "rt      = " << options.rt      << std::endl <<
+                 "cpu     = " << options.cpu     << std::endl << std::endl;
+    std::vector<uint32_t> gaps;
+    if (!measure(false, &gaps))
+        return 1;
+    printResult("Client port in main loop", gaps);
+    if (!measure(true, &gaps))
+        return 1;
+    printResult("Client port in dedicated thread", gaps);
+    return 0;
+}
@@ -4,6 +4,9 @@
 #include <cstdint>
 #include <algorithm>
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 #include <ModbusServerResource.h>
 #include <ModbusClientPort.h>
@@ -14,6 +17,13 @@
 #include "mbridge_config.h"
 #include "modbus/mtcpbridge.h"
 #include "modbus/mtcpclient.h"
+#include "modbus/mclientconnector.h"
+#include "modbus/mdownstream.h"
+#include "modbus/mportlog.h"
+#include "modbus/mrealtime.h"
+#include "modbus/mprefetcher.h"
+#include "modbus/msharedimage.h"
+#include "modbus/mspscqueue.h"
 
 const char* help_options =
 "Usage: mbridge -ctype <type> [-coptions] -stype <type> [-soptions]\n"
@@ -37,6 +47,24 @@ const char* help_options =
 "  * stop (s)        - stop bits: 1, 1.5, 2 (default is 1)\n"
 "  * tfb <timeout>   - timeout first byte for RTU or ASC (millisec, default is 1000)\n"
 "  * tib <timeout>   - timeout inter byte for RTU or ASC (millisec, default is 50)\n"
+"  * rt <priority>   - realtime SCHED_FIFO priority (1-99) of port thread, port is moved to\n"
+"                      dedicated thread (server: RTU and ASC only) (default is 0 - off)\n"
+"  * cpu <n>         - CPU affinity of port thread (server: RTU and ASC only) (default is -1 - off)\n"
+"\n"
+"Options for client:\n"
+"  -cbackoff (-cbo) <timeout> - max reconnect backoff for client port (millisec, default is 10000)\n"
+"  -ckeepalive (-cka) <sec>   - TCP keepalive idle time for client port (sec, 0 - disable, default is 10)\n"
+"  -cprefetch (-cpf) <maxage> - enable prefetch of periodically polled read requests with max age\n"
+"                               of prefetched values (millisec, 0 - disable, default is 0)\n"
+"  -cshm <name>               - publish values read by client into POSIX shared memory <name>\n"
+"  -cshmsize <count>          - max count of read ranges in shared memory (default is 1024)\n"
+"  -cqueue (-cq) <depth>      - max count of requests in downstream queue, requests above the limit\n"
+"                               are rejected with exception 0x06 'Server Device Busy' (1-64, default is\n"
+"                               -smaxconn+1 but not less than 16 for TCP server and 16 for RTU/ASC server)\n"
+"  -cqwait (-cqw) <timeout>   - max estimated wait of request in downstream queue, requests above\n"
+"                               the limit are rejected with exception 0x06 (millisec, 0 - disable, default is 1000)\n"
+"  -cstat <sec>               - print queue and prefetch statistics every <sec> seconds (0 - only when\n"
+"                               mbridge stops, default is 0). Statistics are also printed on SIGUSR1 (Unix)\n"
 "\n"
 "Options for server:\n"
 "  -sunit (-su) <list> - list of units for server to responde like '1,3,6-10,11,27'\n"
@@ -87,6 +115,34 @@ void printErrorSerialServer(const Modbus::Char *source, Modbus::StatusCode statu
         std::cout << source << " error (" << status << "):" << text << std::endl;
 }
 
+void printLog(const Modbus::Char *source, const mPortLog::Record &rec, bool asc)
+{
+    switch (rec.type)
+    {
+    case mPortLog::Log_Opened:
+        printOpened(source);
+        break;
+    case mPortLog::Log_Closed:
+        printClosed(source);
+        break;
+    case mPortLog::Log_Tx:
+        if (asc)
+            printTxAsc(source, rec.data, rec.size);
+        else
+            printTx(source, rec.data, rec.size);
+        break;
+    case mPortLog::Log_Rx:
+        if (asc)
+            printRxAsc(source, rec.data, rec.size);
+        else
+            printRx(source, rec.data, rec.size);
+        break;
+    default:
+        printError(source, rec.status, reinterpret_cast<const Modbus::Char*>(rec.data));
+        break;
+    }
+}
+
 void printNewConnection(const Modbus::Char *source)
 {
     std::cout << "New connection: " << source << std::endl;
@@ -103,6 +159,8 @@ struct Options
     Modbus::SerialSettings ser        ;
     Modbus::TcpSettings    tcp        ; 
     Modbus::String         sSerialPort;
+    int                    rt         ;
+    int                    cpu        ;
 
     Options()
     {
@@ -130,7 +188,11 @@ struct Options
         else
             sSerialPort = dSer.portName;
         ser.portName = sSerialPort.c_str();
+        rt  = 0;
+        cpu = -1;
     }
+
+    inline bool isRealtime() const { return (rt > 0) || (cpu >= 0); }
 };
 
 struct ServerOnlyOptions
@@ -139,8 +201,35 @@ struct ServerOnlyOptions
     uint8_t unitmap[MB_UNITMAP_SIZE];
 };
 
+struct ClientOnlyOptions
+{
+    uint32_t backoff  ;
+    uint32_t keepalive;
+    uint32_t prefetch ;
+    const char *shm   ;
+    uint32_t shmsize  ;
+    uint32_t queue    ;
+    uint32_t qwait    ;
+    uint32_t stat     ;
+
+    ClientOnlyOptions()
+    {
+        const mClientConnector::Defaults &d = mClientConnector::Defaults::instance();
+
+        backoff   = d.maxBackoff;
+        keepalive = d.keepAlive ;
+        prefetch  = 0           ;
+        shm       = nullptr     ;
+        shmsize   = mSharedImage::Defaults::instance().capacity;
+        queue     = 0           ; // Note: 0 - derive from server type and max connections (see `queueDepth()`)
+        qwait     = mDownstream::Defaults::instance().maxWait ;
+        stat      = 0           ;
+    }
+};
+
 Options cliOptions;
 Options srvOptions;
+ClientOnlyOptions cliOnlyOptions;
 ServerOnlyOptions srvOnlyOptions;
 
 bool fillunitmap(const char *s, void *unitmap)
@@ -287,6 +376,86 @@ void parseOptions(int argc, char **argv)
             printf("'-sunit' option (server-only) must have a value: list of unit like '1,3,6-10,11,27' \n");
             exit(1);
         }
+        if (!strcmp(opt, "backoff") || !strcmp(opt, "bo"))
+        {
+            if (!srv && (++i < argc))
+            {
+                cliOnlyOptions.backoff = (uint32_t)atoi(argv[i]);
+                continue;
+            }
+            printf("'-cbackoff' option (client-only) must have an integer value\n");
+            exit(1);
+        }
+        if (!strcmp(opt, "keepalive") || !strcmp(opt, "ka"))
+        {
+            if (!srv && (++i < argc))
+            {
+                cliOnlyOptions.keepalive = (uint32_t)atoi(argv[i]);
+                continue;
+            }
+            printf("'-ckeepalive' option (client-only) must have an integer value\n");
+            exit(1);
+        }
+        if (!strcmp(opt, "prefetch") || !strcmp(opt, "pf"))
+        {
+            if (!srv && (++i < argc))
+            {
+                cliOnlyOptions.prefetch = (uint32_t)atoi(argv[i]);
+                continue;
+            }
+            printf("'-cprefetch' option (client-only) must have an integer value\n");
+            exit(1);
+        }
+        if (!strcmp(opt, "shm"))
+        {
+            if (!srv && (++i < argc))
+            {
+                cliOnlyOptions.shm = argv[i];
+                continue;
+            }
+            printf("'-cshm' option (client-only) must have a value: shared memory name like '/mbridge'\n");
+            exit(1);
+        }
+        if (!strcmp(opt, "shmsize"))
+        {
+            if (!srv && (++i < argc))
+            {
+                cliOnlyOptions.shmsize = (uint32_t)atoi(argv[i]);
+                continue;
+            }
+            printf("'-cshmsize' option (client-only) must have an integer value\n");
+            exit(1);
+        }
+        if (!strcmp(opt, "queue") || !strcmp(opt, "q"))
+        {
+            if (!srv && (++i < argc))
+            {
+                cliOnlyOptions.queue = (uint32_t)atoi(argv[i]);
+                continue;
+            }
+            printf("'-cqueue' option (client-only) must have an integer value\n");
+            exit(1);
+        }
+        if (!strcmp(opt, "qwait") || !strcmp(opt, "qw"))
+        {
+            if (!srv && (++i < argc))
+            {
+                cliOnlyOptions.qwait = (uint32_t)atoi(argv[i]);
+                continue;
+            }
+            printf("'-cqwait' option (client-only) must have an integer value\n");
+            exit(1);
+        }
+        if (!strcmp(opt, "stat"))
+        {
+            if (!srv && (++i < argc))
+            {
+                cliOnlyOptions.stat = (uint32_t)atoi(argv[i]);
+                continue;
+            }
+            printf("'-cstat' option (client-only) must have an integer value\n");
+            exit(1);
+        }
         if (!strcmp(opt, "host") || !strcmp(opt, "h"))
         {
             if (++i < argc)
@@ -405,6 +574,26 @@ void parseOptions(int argc, char **argv)
             printf("'-stop' option must have a value: 1, 1.5 or 2\n");
             exit(1);
         }
+        if (!strcmp(opt, "rt"))
+        {
+            if (++i < argc)
+            {
+                options->rt = atoi(argv[i]);
+                continue;
+            }
+            printf("'-rt' option must have a value: 1-99\n");
+            exit(1);
+        }
+        if (!strcmp(opt, "cpu"))
+        {
+            if (++i < argc)
+            {
+                options->cpu = atoi(argv[i]);
+                continue;
+            }
+            printf("'-cpu' option must have a value: CPU number\n");
+            exit(1);
+        }
         if (!strcmp(opt, "tfb"))
         {
             if (++i < argc)
@@ -454,18 +643,136 @@ void printPort(ModbusPort *port)
     }
 }
 
+// Note: statistics are taken by the thread of the bridge loop and printed by main thread
+struct Statistics
+{
+    mDownstream::Statistics queue        ;
+    uint32_t                depth        ;
+    uint32_t                serviceTime  ;
+    uint32_t                estimatedWait;
+    bool                    hasPrefetch  ;
+    mPrefetcher::Statistics prefetch     ;
+    uint32_t                hitRate      ;
+    uint32_t                load         ;
+};
+
+void printStatistics(const Statistics &s)
+{
+    std::cout << "Queue statistics:"                                  << std::endl <<
+                 "depth         = " << s.depth                        << std::endl <<
+                 "max depth     = " << s.queue.maxDepth               << std::endl <<
+                 "admitted      = " << s.queue.admitted               << std::endl <<
+                 "rejected      = " << s.queue.rejected               << std::endl <<
+                 "rejected wait = " << s.queue.rejectedWait           << std::endl <<
+                 "service time  = " << s.serviceTime   << " us"       << std::endl <<
+                 "wait          = " << s.estimatedWait << " ms"       << std::endl;
+    if (!s.hasPrefetch)
+        return;
+    std::cout << "Prefetch statistics:"                               << std::endl <<
+                 "hits       = " << s.prefetch.hits                   << std::endl <<
+                 "misses     = " << s.prefetch.misses                 << std::endl <<
+                 "hit rate   = " << s.hitRate << '%'                  << std::endl <<
+                 "prefetches = " << s.prefetch.prefetches             << std::endl <<
+                 "wasted     = " << s.prefetch.wasted                 << std::endl <<
+                 "load       = " << s.load << '%'                     << std::endl;
+}
+
+// Note: bridge loop runs in main thread or in dedicated thread of serial server port
+struct Bridge
+{
+    mDownstream      *down    ;
+    ModbusServerPort *srv     ;
+    mPrefetcher      *pref    ;
+    mPortLog         *log     ;
+    int               priority;
+    int               cpu     ;
+    std::atomic<bool> run     ;
+    std::atomic<bool> statRequest;
+    mSpscQueue<Statistics, 4> stats;
+};
+
+void takeStatistics(Bridge *bridge, Statistics *s)
+{
+    s->queue         = bridge->down->statistics();
+    s->depth         = bridge->down->depth();
+    s->serviceTime   = bridge->down->serviceTime();
+    s->estimatedWait = bridge->down->estimatedWait();
+    s->hasPrefetch   = (bridge->pref != nullptr);
+    if (s->hasPrefetch)
+    {
+        s->prefetch = bridge->pref->statistics();
+        s->hitRate  = bridge->pref->hitRate();
+        s->load     = bridge->pref->load();
+    }
+}
+
+void processBridge(Bridge *bridge)
+{
+    bridge->down->process();
+    bridge->srv->process();
+    // Note: process prefetch after server so waiting upstream requests take bus first
+    if (bridge->pref)
+        bridge->pref->process();
+    if (bridge->statRequest.exchange(false))
+    {
+        Statistics s;
+        takeStatistics(bridge, &s);
+        bridge->stats.push(s);
+    }
+}
+
+void bridgeThread(void *arg)
+{
+    Bridge *bridge = static_cast<Bridge*>(arg);
+    std::string err;
+    if (!mRealtime::setCurrentThread(bridge->priority, bridge->cpu, &err))
+        bridge->log->push(mPortLog::Log_Error, Modbus::Status_Bad, err.data(), err.size());
+    while (bridge->run)
+    {
+        processBridge(bridge);
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+// Returns depth limit of downstream queue. TCP server holds at most one request per
+// connection (plus one prefetch request) in the queue, so by default depth doesn't reject
+// connected masters and requests are limited by estimated wait (`-cqwait`)
+uint32_t queueDepth()
+{
+    const uint32_t depth = mDownstream::Defaults::instance().maxQueue;
+    if (cliOnlyOptions.queue)
+        return cliOnlyOptions.queue;
+    if (srvOptions.type == Modbus::TCP)
+        return std::max<uint32_t>(depth, srvOptions.tcp.maxconn + 1);
+    return depth;
+}
+
 volatile bool fRun = true;
+volatile bool fStat = false;
 
 void signal_handler(int /*signal*/)
 {
     fRun = false;
 }
 
+void signal_stat_handler(int /*signal*/)
+{
+    fStat = true;
+}
+
 int main(int argc, char **argv)
 {
     const bool blocking = false;
     ModbusServerPort *srv;
     ModbusClientPort *cli;
+    mClientConnector *conn;
+    mDownstream *down;
+    mPrefetcher *pref = nullptr;
+    mSharedImage *shm = nullptr;
+    mTcpClient *dev = nullptr;
+    mPortLog srvLog;
+    Bridge bridge;
+    mRealtimeThread srvThread;
 
     parseOptions(argc, argv);
 
@@ -479,50 +786,119 @@ int main(int argc, char **argv)
         return 1;
     }
     
+    // Note: client port that is moved into dedicated thread works in blocking mode.
+    // Port that works outside of main thread must not print, its signals are deferred
+    // into `mPortLog` and printed by main thread (see `printLog()`)
+    const bool cliThreaded = cliOptions.isRealtime();
+    const bool srvThreaded = srvOptions.isRealtime();
+    const bool deferLog = cliThreaded || srvThreaded;
+    if (srvThreaded && (srvOptions.type == Modbus::TCP))
+    {
+        std::cout << "'-srt' and '-scpu' options are supported only for RTU and ASC server" << std::endl;
+        return 1;
+    }
     switch (cliOptions.type)
     {
     case Modbus::RTU:
-        cli = Modbus::createClientPort(Modbus::RTU, &cliOptions.ser, blocking);
+        cli = Modbus::createClientPort(Modbus::RTU, &cliOptions.ser, cliThreaded);
         cli->setObjectName("RTU:Client");
-        cli->connect(&ModbusClientPort::signalTx, printTx);
-        cli->connect(&ModbusClientPort::signalRx, printRx);
+        if (!deferLog)
+        {
+            cli->connect(&ModbusClientPort::signalTx, printTx);
+            cli->connect(&ModbusClientPort::signalRx, printRx);
+        }
         break;
     case Modbus::ASC:
-        cli = Modbus::createClientPort(Modbus::ASC, &cliOptions.ser, blocking);
+        cli = Modbus::createClientPort(Modbus::ASC, &cliOptions.ser, cliThreaded);
         cli->setObjectName("ASC:Client");
-        cli->connect(&ModbusClientPort::signalTx, printTxAsc);
-        cli->connect(&ModbusClientPort::signalRx, printRxAsc);
+        if (!deferLog)
+        {
+            cli->connect(&ModbusClientPort::signalTx, printTxAsc);
+            cli->connect(&ModbusClientPort::signalRx, printRxAsc);
+        }
         break;
     default:
-        cli = Modbus::createClientPort(Modbus::TCP, &cliOptions.tcp, blocking);
+        cli = Modbus::createClientPort(Modbus::TCP, &cliOptions.tcp, cliThreaded);
         cli->setObjectName("TCP:Client");
-        cli->connect(&ModbusClientPort::signalTx, printTx);
-        cli->connect(&ModbusClientPort::signalRx, printRx);
+        if (!deferLog)
+        {
+            cli->connect(&ModbusClientPort::signalTx, printTx);
+            cli->connect(&ModbusClientPort::signalRx, printRx);
+        }
         break;
     }
-    cli->connect(&ModbusClientPort::signalOpened, printOpened);
-    cli->connect(&ModbusClientPort::signalClosed, printClosed);
-    cli->connect(&ModbusClientPort::signalError , printError );
+    if (!deferLog)
+    {
+        cli->connect(&ModbusClientPort::signalOpened, printOpened);
+        cli->connect(&ModbusClientPort::signalClosed, printClosed);
+        cli->connect(&ModbusClientPort::signalError , printError );
+    }
+
+    conn = new mClientConnector(cli);
+    if (cliOnlyOptions.backoff < conn->minBackoff())
+        conn->setMinBackoff(cliOnlyOptions.backoff);
+    conn->setMaxBackoff(cliOnlyOptions.backoff);
+    conn->setKeepAlive(cliOnlyOptions.keepalive);
+
+    down = new mDownstream(cli);
+    down->setConnector(conn);
+    if (deferLog)
+        down->log()->attach(cli);
+    down->setMaxQueue(queueDepth());
+    down->setMaxWait(cliOnlyOptions.qwait);
+
+    if (cliOnlyOptions.shm)
+    {
+        shm = new mSharedImage();
+        shm->setName(cliOnlyOptions.shm);
+        shm->setCapacity(cliOnlyOptions.shmsize);
+        if (!shm->open())
+        {
+            std::cout << "Shared memory '" << shm->name() << "' error: " << shm->lastErrorText() << std::endl;
+            return 1;
+        }
+    }
+
+    if (cliOnlyOptions.prefetch)
+    {
+        pref = new mPrefetcher(down);
+        pref->setSharedImage(shm);
+        pref->setMaxAge(cliOnlyOptions.prefetch);
+    }
 
     switch (srvOptions.type)
     {
     case Modbus::RTU:
-        srv = Modbus::createServerPort(cli, Modbus::RTU, &srvOptions.ser, blocking);
+        dev = new mTcpClient(down);
+        dev->setPrefetcher(pref);
+        dev->setSharedImage(shm);
+        srv = Modbus::createServerPort(dev, Modbus::RTU, &srvOptions.ser, blocking);
         srv->setObjectName("RTU:Server");
-        srv->connect(&ModbusServerPort::signalTx, printTx);
-        srv->connect(&ModbusServerPort::signalRx, printRx);
-        srv->connect(&ModbusServerPort::signalError, printErrorSerialServer);
+        if (!srvThreaded)
+        {
+            srv->connect(&ModbusServerPort::signalTx, printTx);
+            srv->connect(&ModbusServerPort::signalRx, printRx);
+            srv->connect(&ModbusServerPort::signalError, printErrorSerialServer);
+        }
         break;
     case Modbus::ASC:
-        srv = Modbus::createServerPort(cli, Modbus::ASC, &srvOptions.ser, blocking);
+        dev = new mTcpClient(down);
+        dev->setPrefetcher(pref);
+        dev->setSharedImage(shm);
+        srv = Modbus::createServerPort(dev, Modbus::ASC, &srvOptions.ser, blocking);
         srv->setObjectName("ASC:Server");
-        srv->connect(&ModbusServerPort::signalTx, printTxAsc);
-        srv->connect(&ModbusServerPort::signalRx, printRxAsc);
-        srv->connect(&ModbusServerPort::signalError, printErrorSerialServer);
+        if (!srvThreaded)
+        {
+            srv->connect(&ModbusServerPort::signalTx, printTxAsc);
+            srv->connect(&ModbusServerPort::signalRx, printRxAsc);
+            srv->connect(&ModbusServerPort::signalError, printErrorSerialServer);
+        }
         break;
     default:
     {
-        mTcpBridge *tcp = new mTcpBridge(cli);
+        mTcpBridge *tcp = new mTcpBridge(down);
+        tcp->setPrefetcher(pref);
+        tcp->setSharedImage(shm);
         tcp->setPort(srvOptions.tcp.port);
         tcp->setTimeout(srvOptions.tcp.timeout);
         tcp->setMaxConnections(srvOptions.tcp.maxconn);
@@ -536,13 +912,42 @@ int main(int argc, char **argv)
     }
         break;
     }
-    srv->connect(&ModbusServerPort::signalOpened, printOpened);
-    srv->connect(&ModbusServerPort::signalClosed, printClosed);
+    if (srvThreaded)
+        srvLog.attach(srv);
+    else
+    {
+        srv->connect(&ModbusServerPort::signalOpened, printOpened);
+        srv->connect(&ModbusServerPort::signalClosed, printClosed);
+    }
+
+    bridge.down     = down;
+    bridge.srv      = srv;
+    bridge.pref     = pref;
+    bridge.log      = &srvLog;
+    bridge.priority = srvOptions.rt;
+    bridge.cpu      = srvOptions.cpu;
+    bridge.run      = true;
+    bridge.statRequest = false;
 
     // Print Client params
     std::cout << cli->objectName() << " parameters:" << std::endl
               << "----------------------" << std::endl;
     printPort(cli->port());
+    // Note: names of client-only params are shortened to fit column of `printPort()`
+    std::cout << "backoff = " << conn->maxBackoff() << std::endl;
+    if (cli->type() == Modbus::TCP)
+        std::cout << "ka      = " << conn->keepAlive() << std::endl;
+    std::cout << "queue   = " << down->maxQueue() << std::endl <<
+                 "qwait   = " << down->maxWait() << std::endl;
+    if (pref)
+        std::cout << "pf      = " << pref->maxAge() << std::endl;
+    if (cliOnlyOptions.stat)
+        std::cout << "stat    = " << cliOnlyOptions.stat << std::endl;
+    if (shm)
+        std::cout << "shm     = " << shm->name() << " (" << shm->capacity() << ')' << std::endl;
+    if (cliThreaded)
+        std::cout << "rt      = " << cliOptions.rt << std::endl <<
+                     "cpu     = " << cliOptions.cpu << std::endl;
     std::cout << std::endl;
 
     // Print Server params
@@ -565,16 +970,77 @@ int main(int argc, char **argv)
         srv->setUnitMap(srvOnlyOptions.ptrunitmap);
         printunitmap(srvOnlyOptions.ptrunitmap);
     }    
+    if (srvThreaded)
+        std::cout << "rt      = " << srvOptions.rt << std::endl <<
+                     "cpu     = " << srvOptions.cpu << std::endl;
     std::cout << std::endl;
 
+    if (cliThreaded || srvThreaded)
+    {
+        std::string err;
+        if (cliThreaded && !down->start(cliOptions.rt, cliOptions.cpu, &err))
+        {
+            std::cout << cli->objectName() << " thread error: " << err << std::endl;
+            return 1;
+        }
+        if (srvThreaded && !srvThread.start(bridgeThread, &bridge, &err))
+        {
+            std::cout << srv->objectName() << " thread error: " << err << std::endl;
+            down->stop();
+            return 1;
+        }
+        // Note: memory is locked after threads are created, so their stacks are locked too
+        if (!mRealtime::lockMemory(&err))
+            std::cout << "Warning: " << err << std::endl;
+    }
+
     std::signal(SIGINT, signal_handler);
+#ifdef SIGUSR1
+    std::signal(SIGUSR1, signal_stat_handler);
+#endif
     std::cout << "mbridge starts ..." << std::endl;
+    Modbus::Timer statTimestamp = Modbus::timer();
     while (fRun)
     {
-        srv->process();
+        if (cliOnlyOptions.stat && ((Modbus::timer() - statTimestamp) >= cliOnlyOptions.stat * 1000))
+        {
+            statTimestamp = Modbus::timer();
+            fStat = true;
+        }
+        if (fStat)
+        {
+            fStat = false;
+            bridge.statRequest = true;
+        }
+        if (!srvThreaded)
+            processBridge(&bridge);
+        Statistics stat;
+        while (bridge.stats.pop(stat))
+            printStatistics(stat);
+        mPortLog::Record rec;
+        while (down->log()->pop(rec))
+            printLog(cli->objectName(), rec, cli->type() == Modbus::ASC);
+        while (srvLog.pop(rec))
+        {
+            // Note: serial server read timeout is a normal state while master is silent
+            if ((rec.type == mPortLog::Log_Error) && (rec.status == Modbus::Status_BadSerialReadTimeout))
+                continue;
+            printLog(srv->objectName(), rec, srv->type() == Modbus::ASC);
+        }
         Modbus::msleep(1);
     }
+    bridge.run = false;
+    srvThread.join();
+    down->stop();
+    Statistics stat;
+    takeStatistics(&bridge, &stat);
+    printStatistics(stat);
     delete srv;
+    delete dev;
+    delete pref;
+    delete shm;
+    delete down;
+    delete conn;
     delete cli;
     std::cout << "mbridge stopped" << std::endl;
 }
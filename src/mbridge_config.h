@@ -2,7 +2,7 @@
 #define MBRIDGE_CONFIG_H
 
 #define MBRIDGE_VERSION_MAJOR 0
-#define MBRIDGE_VERSION_MINOR 2
+#define MBRIDGE_VERSION_MINOR 3
 #define MBRIDGE_VERSION_PATCH 0
 
 #define MBRIDGE_VERSION ((MBRIDGE_VERSION_MAJOR<<16)|(MBRIDGE_VERSION_MINOR<<8)|(MBRIDGE_VERSION_PATCH))
@@ -0,0 +1,140 @@
+#include "mclientconnector.h"
+
+#include <ModbusClientPort.h>
+#include <ModbusPort.h>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <cstdint>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#ifndef _WIN32
+// Note: `Modbus::Handle` is opaque native handle of the port (pointer-sized value
+// on some platforms), so socket descriptor is converted explicitly
+static inline int socketHandle(int handle)
+{
+    return handle;
+}
+
+static inline int socketHandle(const void *handle)
+{
+    return static_cast<int>(reinterpret_cast<intptr_t>(handle));
+}
+#endif
+
+mClientConnector::Defaults::Defaults() :
+    minBackoff   (500  ),
+    maxBackoff   (10000),
+    keepAlive    (10   ),
+    probeInterval(1000 )
+{
+}
+
+const mClientConnector::Defaults &mClientConnector::Defaults::instance()
+{
+    static const Defaults d;
+    return d;
+}
+
+mClientConnector::mClientConnector(ModbusClientPort *clientPort) :
+    m_clientPort(clientPort),
+    m_ready(false)
+{
+    const Defaults &d = Defaults::instance();
+    m_state      = STATE_CONNECTING; // Note: open port eagerly at startup
+    m_minBackoff = d.minBackoff;
+    m_maxBackoff = d.maxBackoff;
+    m_keepAlive  = d.keepAlive;
+    m_backoff    = m_minBackoff;
+    m_timestamp  = Modbus::timer();
+}
+
+void mClientConnector::process()
+{
+    ModbusPort *port = m_clientPort->port();
+    Modbus::StatusCode r;
+    switch (m_state)
+    {
+    case STATE_OPENED:
+        if (port->isOpen())
+        {
+            if ((Modbus::timer() - m_timestamp) < Defaults::instance().probeInterval)
+                return;
+            m_timestamp = Modbus::timer();
+            // Note: probe only an idle link, otherwise it can steal response bytes
+            if ((m_clientPort->currentClient() != nullptr) || probe())
+                return;
+            m_clientPort->close();
+        }
+        // Note: link was dropped, try to reconnect immediately
+        m_ready.store(false, std::memory_order_release);
+        m_backoff = m_minBackoff;
+        m_state = STATE_CONNECTING;
+        // no need break
+    case STATE_CONNECTING:
+        r = port->open();
+        if (Modbus::StatusIsProcessing(r))
+            return;
+        if (Modbus::StatusIsGood(r))
+        {
+            onOpened();
+            return;
+        }
+        m_timestamp = Modbus::timer();
+        m_state = STATE_WAIT_FOR_RECONNECT;
+        return;
+    case STATE_WAIT_FOR_RECONNECT:
+        // Note: port can be opened by the request that was in progress while link was dropped
+        if (port->isOpen())
+        {
+            onOpened();
+            return;
+        }
+        if ((Modbus::timer() - m_timestamp) < m_backoff)
+            return;
+        m_backoff = (m_backoff < m_maxBackoff/2) ? m_backoff*2 : m_maxBackoff;
+        m_state = STATE_CONNECTING;
+        return;
+    }
+}
+
+void mClientConnector::onOpened()
+{
+    m_state = STATE_OPENED;
+    m_ready.store(true, std::memory_order_release);
+    m_backoff = m_minBackoff;
+    m_timestamp = Modbus::timer();
+#ifndef _WIN32
+    if ((m_clientPort->type() != Modbus::TCP) || (m_keepAlive == 0))
+        return;
+    int fd = socketHandle(m_clientPort->port()->handle());
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+#ifdef TCP_KEEPIDLE
+    int idle = static_cast<int>(m_keepAlive);
+    int intvl = 1;
+    int cnt = 3;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE , &idle , sizeof(idle ));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT  , &cnt  , sizeof(cnt  ));
+#endif
+#endif
+}
+
+bool mClientConnector::probe()
+{
+#ifndef _WIN32
+    if (m_clientPort->type() != Modbus::TCP)
+        return true;
+    char c;
+    ssize_t n = recv(socketHandle(m_clientPort->port()->handle()), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0) // peer closed connection
+        return false;
+    if ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+        return false;
+#endif
+    return true;
+}
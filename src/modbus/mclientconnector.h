@@ -0,0 +1,74 @@
+#ifndef MCLIENTCONNECTOR_H
+#define MCLIENTCONNECTOR_H
+
+#include <atomic>
+
+#include <Modbus.h>
+
+class ModbusClientPort;
+
+/*
+   Keeps the downstream client port open outside of the request path.
+   The port is opened at startup, a TCP link is watched with keepalive and
+   a cheap peer-close probe, and after a drop it is reopened with exponential
+   backoff. While the link is down upstream requests must fail fast (see
+   `mDownstream`) instead of paying the connect cost plus a timeout.
+   `process()` must be called from the thread that owns client port,
+   `isReady()` can be called from any thread.
+*/
+class mClientConnector
+{
+public:
+    struct Defaults
+    {
+        const uint32_t minBackoff    ;
+        const uint32_t maxBackoff    ;
+        const uint32_t keepAlive     ;
+        const uint32_t probeInterval ;
+
+        Defaults();
+        static const Defaults &instance();
+    };
+
+public:
+    mClientConnector(ModbusClientPort *clientPort);
+
+public:
+    inline ModbusClientPort *clientPort() const { return m_clientPort; }
+    inline uint32_t minBackoff() const { return m_minBackoff; }
+    inline void setMinBackoff(uint32_t timeout) { m_minBackoff = timeout; }
+    inline uint32_t maxBackoff() const { return m_maxBackoff; }
+    inline void setMaxBackoff(uint32_t timeout) { m_maxBackoff = timeout; }
+    inline uint32_t keepAlive() const { return m_keepAlive; }
+    inline void setKeepAlive(uint32_t sec) { m_keepAlive = sec; }
+
+    // Returns `true` if downstream port is open and requests can go out immediately
+    inline bool isReady() const { return m_ready.load(std::memory_order_acquire); }
+
+    // Drives (re)connection. Must be called periodically from the main loop
+    void process();
+
+private:
+    enum State
+    {
+        STATE_CONNECTING,
+        STATE_OPENED,
+        STATE_WAIT_FOR_RECONNECT
+    };
+
+private:
+    void onOpened();
+    bool probe();
+
+private:
+    ModbusClientPort *m_clientPort;
+    State m_state;
+    std::atomic<bool> m_ready;
+    uint32_t m_minBackoff;
+    uint32_t m_maxBackoff;
+    uint32_t m_keepAlive;
+    uint32_t m_backoff;
+    Modbus::Timer m_timestamp;
+};
+
+#endif // MCLIENTCONNECTOR_H
@@ -0,0 +1,670 @@
+#include "mdownstream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include <ModbusClientPort.h>
+#include <ModbusPort.h>
+
+#include "mclientconnector.h"
+
+static inline uint16_t bitsSize(uint16_t count)
+{
+    return static_cast<uint16_t>((count + 7) / 8);
+}
+
+static inline uint16_t regsSize(uint16_t count)
+{
+    return static_cast<uint16_t>(count * sizeof(uint16_t));
+}
+
+mDownstream::Defaults::Defaults() :
+    maxQueue(16  ),
+    maxWait (1000)
+{
+}
+
+const mDownstream::Defaults &mDownstream::Defaults::instance()
+{
+    static const Defaults d;
+    return d;
+}
+
+static inline uint32_t elapsedSince(const std::chrono::steady_clock::time_point &start)
+{
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+mDownstream::mDownstream(ModbusClientPort *clientPort) : ModbusObject(),
+    m_clientPort(clientPort),
+    m_connector(nullptr),
+    m_pending(0),
+    m_serviceTime(0),
+    m_current(nullptr),
+    m_run(false),
+    m_priority(0),
+    m_cpu(-1)
+{
+    const Defaults &d = Defaults::instance();
+    setObjectName(m_clientPort->objectName());
+    m_maxQueue = d.maxQueue;
+    m_maxWait = d.maxWait;
+    memset(&m_stat, 0, sizeof(m_stat));
+    memset(m_jobs, 0, sizeof(m_jobs));
+    for (Job &j : m_jobs)
+    {
+        j.client = nullptr;
+        j.state = Job_Free;
+    }
+}
+
+mDownstream::~mDownstream()
+{
+    stop();
+}
+
+void mDownstream::setMaxQueue(uint32_t depth)
+{
+    if (depth < 1)
+        depth = 1;
+    else if (depth > MaxJobs)
+        depth = MaxJobs;
+    m_maxQueue = depth;
+}
+
+bool mDownstream::isReady() const
+{
+    return (m_connector == nullptr) || m_connector->isReady();
+}
+
+bool mDownstream::isPortReady() const
+{
+    // Note: `isReady()` is updated by connector once per loop, but port can be closed
+    // by the previous request (link drop), so job must not reopen it in request path.
+    // Without connector port is opened by request as usual
+    if (m_connector == nullptr)
+        return true;
+    return m_connector->isReady() && m_clientPort->port()->isOpen();
+}
+
+uint32_t mDownstream::estimatedWait() const
+{
+    return static_cast<uint32_t>((static_cast<uint64_t>(m_pending) * m_serviceTime) / 1000);
+}
+
+bool mDownstream::start(int priority, int cpu, std::string *errorText)
+{
+    if (isThreaded())
+        return true;
+    m_priority = priority;
+    m_cpu = cpu;
+    m_run = true;
+    if (!m_thread.start(&mDownstream::threadFunc, this, errorText))
+    {
+        m_run = false;
+        return false;
+    }
+    return true;
+}
+
+void mDownstream::stop()
+{
+    if (!isThreaded())
+        return;
+    m_run = false;
+    m_thread.join();
+}
+
+void mDownstream::process()
+{
+    if (isThreaded())
+    {
+        collect();
+        return;
+    }
+    if (m_connector)
+        m_connector->process();
+    step();
+}
+
+void mDownstream::cancelRequest(ModbusObject *client)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+        return;
+    if (j->state == Job_Done)
+        release(j);
+    else
+        j->state = Job_Canceled; // Note: job is freed when it's completed
+}
+
+Modbus::StatusCode mDownstream::readCoils(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t count, void *values)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        Modbus::StatusCode r = admit(client, MBF_READ_COILS, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        j->offset = offset;
+        j->count = count;
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    if (Modbus::StatusIsGood(j->result))
+        memcpy(values, j->rdata, bitsSize(count));
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::readDiscreteInputs(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t count, void *values)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        Modbus::StatusCode r = admit(client, MBF_READ_DISCRETE_INPUTS, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        j->offset = offset;
+        j->count = count;
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    if (Modbus::StatusIsGood(j->result))
+        memcpy(values, j->rdata, bitsSize(count));
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::readHoldingRegisters(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t count, uint16_t *values)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        Modbus::StatusCode r = admit(client, MBF_READ_HOLDING_REGISTERS, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        j->offset = offset;
+        j->count = count;
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    if (Modbus::StatusIsGood(j->result))
+        memcpy(values, j->rdata, regsSize(count));
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::readInputRegisters(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t count, uint16_t *values)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        Modbus::StatusCode r = admit(client, MBF_READ_INPUT_REGISTERS, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        j->offset = offset;
+        j->count = count;
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    if (Modbus::StatusIsGood(j->result))
+        memcpy(values, j->rdata, regsSize(count));
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::writeSingleCoil(ModbusObject *client, uint8_t unit, uint16_t offset, bool value)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        Modbus::StatusCode r = admit(client, MBF_WRITE_SINGLE_COIL, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        j->offset = offset;
+        j->value = value;
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::writeSingleRegister(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t value)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        Modbus::StatusCode r = admit(client, MBF_WRITE_SINGLE_REGISTER, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        j->offset = offset;
+        j->value = value;
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::readExceptionStatus(ModbusObject *client, uint8_t unit, uint8_t *value)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        Modbus::StatusCode r = admit(client, MBF_READ_EXCEPTION_STATUS, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    if (Modbus::StatusIsGood(j->result))
+        *value = reinterpret_cast<const uint8_t*>(j->rdata)[0];
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::diagnostics(ModbusObject *client, uint8_t unit, uint16_t subfunc, uint8_t insize, const uint8_t *indata, uint8_t *outsize, uint8_t *outdata)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        Modbus::StatusCode r = admit(client, MBF_DIAGNOSTICS, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        j->value = subfunc;
+        j->inSize = insize;
+        memcpy(j->wdata, indata, insize);
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    if (Modbus::StatusIsGood(j->result))
+    {
+        *outsize = j->outSize;
+        memcpy(outdata, j->rdata, j->outSize);
+    }
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::getCommEventCounter(ModbusObject *client, uint8_t unit, uint16_t *status, uint16_t *eventCount)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        Modbus::StatusCode r = admit(client, MBF_GET_COMM_EVENT_COUNTER, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    if (Modbus::StatusIsGood(j->result))
+    {
+        *status = j->status;
+        *eventCount = j->eventCount;
+    }
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::getCommEventLog(ModbusObject *client, uint8_t unit, uint16_t *status, uint16_t *eventCount, uint16_t *messageCount, uint8_t *eventBuffSize, uint8_t *eventBuff)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        Modbus::StatusCode r = admit(client, MBF_GET_COMM_EVENT_LOG, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    if (Modbus::StatusIsGood(j->result))
+    {
+        *status = j->status;
+        *eventCount = j->eventCount;
+        *messageCount = j->messageCount;
+        *eventBuffSize = j->outSize;
+        memcpy(eventBuff, j->rdata, j->outSize);
+    }
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::writeMultipleCoils(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t count, const void *values)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        if (bitsSize(count) > sizeof(Job::wdata))
+            return Modbus::Status_BadIllegalDataValue;
+        Modbus::StatusCode r = admit(client, MBF_WRITE_MULTIPLE_COILS, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        j->offset = offset;
+        j->count = count;
+        memcpy(j->wdata, values, bitsSize(count));
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::writeMultipleRegisters(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t count, const uint16_t *values)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        if (regsSize(count) > sizeof(Job::wdata))
+            return Modbus::Status_BadIllegalDataValue;
+        Modbus::StatusCode r = admit(client, MBF_WRITE_MULTIPLE_REGISTERS, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        j->offset = offset;
+        j->count = count;
+        memcpy(j->wdata, values, regsSize(count));
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::reportServerID(ModbusObject *client, uint8_t unit, uint8_t *count, uint8_t *data)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        Modbus::StatusCode r = admit(client, MBF_REPORT_SERVER_ID, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    if (Modbus::StatusIsGood(j->result))
+    {
+        *count = j->outSize;
+        memcpy(data, j->rdata, j->outSize);
+    }
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::maskWriteRegister(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t andMask, uint16_t orMask)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        Modbus::StatusCode r = admit(client, MBF_MASK_WRITE_REGISTER, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        j->offset = offset;
+        j->value = andMask;
+        j->orMask = orMask;
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::readWriteMultipleRegisters(ModbusObject *client, uint8_t unit, uint16_t readOffset, uint16_t readCount, uint16_t *readValues, uint16_t writeOffset, uint16_t writeCount, const uint16_t *writeValues)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        if ((regsSize(readCount) > sizeof(Job::rdata)) || (regsSize(writeCount) > sizeof(Job::wdata)))
+            return Modbus::Status_BadIllegalDataValue;
+        Modbus::StatusCode r = admit(client, MBF_READ_WRITE_MULTIPLE_REGISTERS, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        j->offset = readOffset;
+        j->count = readCount;
+        j->writeOffset = writeOffset;
+        j->writeCount = writeCount;
+        memcpy(j->wdata, writeValues, regsSize(writeCount));
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    if (Modbus::StatusIsGood(j->result))
+        memcpy(readValues, j->rdata, regsSize(readCount));
+    return release(j);
+}
+
+Modbus::StatusCode mDownstream::readFIFOQueue(ModbusObject *client, uint8_t unit, uint16_t fifoadr, uint16_t *count, uint16_t *values)
+{
+    Job *j = find(client);
+    if (j == nullptr)
+    {
+        Modbus::StatusCode r = admit(client, MBF_READ_FIFO_QUEUE, unit, &j);
+        if (!Modbus::StatusIsProcessing(r))
+            return r;
+        j->offset = fifoadr;
+        submit(j);
+    }
+    if (!isDone(j))
+        return Modbus::Status_Processing;
+    if (Modbus::StatusIsGood(j->result))
+    {
+        // Note: count is received from device, it must not exceed buffer
+        uint16_t c = std::min<uint16_t>(j->count, MaxDataSize);
+        *count = c;
+        memcpy(values, j->rdata, regsSize(c));
+    }
+    return release(j);
+}
+
+mDownstream::Job *mDownstream::find(ModbusObject *client)
+{
+    for (Job &j : m_jobs)
+    {
+        if ((j.client == client) && (j.state != Job_Free) && (j.state != Job_Canceled))
+            return &j;
+    }
+    return nullptr;
+}
+
+Modbus::StatusCode mDownstream::admit(ModbusObject *client, uint8_t func, uint8_t unit, Job **job)
+{
+    // Note: requests must not wait for the connection in the request path
+    if (!isReady())
+        return Modbus::Status_BadGatewayPathUnavailable;
+    // Note: admitted request must not wait longer than upstream master timeout,
+    // so reject it at once instead of queueing it
+    if (m_pending >= m_maxQueue)
+    {
+        m_stat.rejected++;
+        return Modbus::Status_BadServerDeviceBusy;
+    }
+    if (m_maxWait && (estimatedWait() > m_maxWait))
+    {
+        m_stat.rejectedWait++;
+        return Modbus::Status_BadServerDeviceBusy;
+    }
+    for (Job &j : m_jobs)
+    {
+        if (j.state == Job_Free)
+        {
+            j.client = client;
+            j.func = func;
+            j.unit = unit;
+            j.elapsed = 0;
+            // Note: outputs of previous request must not leak into failed request
+            j.count = 0;
+            j.outSize = 0;
+            j.status = 0;
+            j.eventCount = 0;
+            j.messageCount = 0;
+            *job = &j;
+            m_stat.admitted++;
+            return Modbus::Status_Processing;
+        }
+    }
+    // Note: canceled jobs that are not completed yet can still hold the pool
+    m_stat.rejected++;
+    return Modbus::Status_BadServerDeviceBusy;
+}
+
+void mDownstream::submit(Job *job)
+{
+    job->state = Job_Queued;
+    m_pending++;
+    if (m_pending > m_stat.maxDepth)
+        m_stat.maxDepth = m_pending;
+    // Note: queue is greater than count of jobs so it can't be full
+    m_requests.push(static_cast<uint16_t>(job - m_jobs));
+}
+
+bool mDownstream::isDone(Job *job)
+{
+    if (isThreaded())
+        collect();
+    else
+        step();
+    return job->state == Job_Done;
+}
+
+Modbus::StatusCode mDownstream::release(Job *job)
+{
+    job->client = nullptr;
+    job->state = Job_Free;
+    return job->result;
+}
+
+void mDownstream::complete(Job *job)
+{
+    m_pending--;
+    // Note: exponential moving average (1/8) of service time of executed requests
+    if (job->elapsed)
+        m_serviceTime = m_serviceTime ? (m_serviceTime * 7 + job->elapsed) / 8 : job->elapsed;
+    if (job->state == Job_Canceled)
+        release(job);
+    else
+        job->state = Job_Done;
+}
+
+void mDownstream::collect()
+{
+    uint16_t i;
+    while (m_completions.pop(i))
+        complete(&m_jobs[i]);
+}
+
+void mDownstream::step()
+{
+    if (m_current == nullptr)
+    {
+        uint16_t i;
+        if (!m_requests.pop(i))
+            return;
+        m_current = &m_jobs[i];
+        if (m_current->state == Job_Canceled)
+        {
+            complete(m_current);
+            m_current = nullptr;
+            return;
+        }
+        if (!isPortReady())
+        {
+            m_current->result = Modbus::Status_BadGatewayPathUnavailable;
+            complete(m_current);
+            m_current = nullptr;
+            return;
+        }
+        m_start = std::chrono::steady_clock::now();
+    }
+    Modbus::StatusCode r = exec(m_current);
+    if (Modbus::StatusIsProcessing(r))
+        return;
+    m_current->result = r;
+    m_current->elapsed = elapsedSince(m_start);
+    complete(m_current);
+    m_current = nullptr;
+}
+
+Modbus::StatusCode mDownstream::exec(Job *job)
+{
+    uint8_t *rbytes = reinterpret_cast<uint8_t*>(job->rdata);
+    const uint8_t *wbytes = reinterpret_cast<const uint8_t*>(job->wdata);
+    switch (job->func)
+    {
+    case MBF_READ_COILS:
+        return m_clientPort->readCoils(this, job->unit, job->offset, job->count, job->rdata);
+    case MBF_READ_DISCRETE_INPUTS:
+        return m_clientPort->readDiscreteInputs(this, job->unit, job->offset, job->count, job->rdata);
+    case MBF_READ_HOLDING_REGISTERS:
+        return m_clientPort->readHoldingRegisters(this, job->unit, job->offset, job->count, job->rdata);
+    case MBF_READ_INPUT_REGISTERS:
+        return m_clientPort->readInputRegisters(this, job->unit, job->offset, job->count, job->rdata);
+    case MBF_WRITE_SINGLE_COIL:
+        return m_clientPort->writeSingleCoil(this, job->unit, job->offset, job->value != 0);
+    case MBF_WRITE_SINGLE_REGISTER:
+        return m_clientPort->writeSingleRegister(this, job->unit, job->offset, job->value);
+    case MBF_READ_EXCEPTION_STATUS:
+        return m_clientPort->readExceptionStatus(this, job->unit, rbytes);
+    case MBF_DIAGNOSTICS:
+        return m_clientPort->diagnostics(this, job->unit, job->value, job->inSize, wbytes, &job->outSize, rbytes);
+    case MBF_GET_COMM_EVENT_COUNTER:
+        return m_clientPort->getCommEventCounter(this, job->unit, &job->status, &job->eventCount);
+    case MBF_GET_COMM_EVENT_LOG:
+        return m_clientPort->getCommEventLog(this, job->unit, &job->status, &job->eventCount, &job->messageCount, &job->outSize, rbytes);
+    case MBF_WRITE_MULTIPLE_COILS:
+        return m_clientPort->writeMultipleCoils(this, job->unit, job->offset, job->count, wbytes);
+    case MBF_WRITE_MULTIPLE_REGISTERS:
+        return m_clientPort->writeMultipleRegisters(this, job->unit, job->offset, job->count, job->wdata);
+    case MBF_REPORT_SERVER_ID:
+        return m_clientPort->reportServerID(this, job->unit, &job->outSize, rbytes);
+    case MBF_MASK_WRITE_REGISTER:
+        return m_clientPort->maskWriteRegister(this, job->unit, job->offset, job->value, job->orMask);
+    case MBF_READ_WRITE_MULTIPLE_REGISTERS:
+        return m_clientPort->readWriteMultipleRegisters(this, job->unit, job->offset, job->count, job->rdata, job->writeOffset, job->writeCount, job->wdata);
+    case MBF_READ_FIFO_QUEUE:
+        return m_clientPort->readFIFOQueue(this, job->unit, job->offset, &job->count, job->rdata);
+    default:
+        return Modbus::Status_BadIllegalFunction;
+    }
+}
+
+void mDownstream::threadFunc(void *arg)
+{
+    static_cast<mDownstream*>(arg)->run();
+}
+
+void mDownstream::run()
+{
+    std::string err;
+    if (!mRealtime::setCurrentThread(m_priority, m_cpu, &err))
+        m_log.push(mPortLog::Log_Error, Modbus::Status_Bad, err.data(), err.size());
+    while (m_run)
+    {
+        if (m_connector)
+            m_connector->process();
+        uint16_t i;
+        if (!m_requests.pop(i))
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+        Job *j = &m_jobs[i];
+        if (!isPortReady())
+            j->result = Modbus::Status_BadGatewayPathUnavailable;
+        else
+        {
+            // Note: client port is in blocking mode, loop is just for safety
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            Modbus::StatusCode r;
+            do
+            {
+                r = exec(j);
+            }
+            while (Modbus::StatusIsProcessing(r) && m_run);
+            j->result = r;
+            j->elapsed = elapsedSince(start);
+        }
+        m_completions.push(i);
+    }
+}
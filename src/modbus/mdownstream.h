@@ -0,0 +1,188 @@
+#ifndef MDOWNSTREAM_H
+#define MDOWNSTREAM_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include <ModbusObject.h>
+
+#include "mportlog.h"
+#include "mrealtime.h"
+#include "mspscqueue.h"
+
+class ModbusClientPort;
+class mClientConnector;
+
+/*
+   Queue of upstream requests in front of the downstream client port.
+   Every client (`mTcpClient`, `mPrefetcher`) can have one request in the queue,
+   requests are executed in FIFO order using preallocated buffers.
+
+   By default requests are executed by `process()` in the thread of the bridge loop
+   (main thread or dedicated server port thread).
+   After `start()` client port is owned by dedicated thread with optional
+   realtime priority and CPU affinity: requests and results are passed through
+   lock-free queues and client port signals must be deferred into `log()`,
+   so serial timing does not depend on the main loop.
+
+   Queue is bounded: new request is rejected immediately with
+   `Status_BadServerDeviceBusy` (exception 0x06) if queue already holds `maxQueue`
+   requests or if estimated wait (queue depth * average service time) exceeds
+   `maxWait` millisec, so upstream master gets fast signal to back off.
+*/
+class mDownstream : public ModbusObject
+{
+public:
+    struct Defaults
+    {
+        const uint32_t maxQueue;
+        const uint32_t maxWait ; // millisec, 0 - don't limit (default is typical master response timeout)
+
+        Defaults();
+        static const Defaults &instance();
+    };
+
+    struct Statistics
+    {
+        uint32_t admitted    ;
+        uint32_t rejected    ; // rejected because of queue depth
+        uint32_t rejectedWait; // rejected because of estimated wait
+        uint32_t maxDepth    ;
+    };
+
+public:
+    mDownstream(ModbusClientPort *clientPort);
+    ~mDownstream();
+
+public:
+    inline ModbusClientPort *clientPort() const { return m_clientPort; }
+    // Returns deferred log for client port signals (see `mPortLog::attach()`)
+    inline mPortLog *log() { return &m_log; }
+    inline mClientConnector *connector() const { return m_connector; }
+    inline void setConnector(mClientConnector *connector) { m_connector = connector; }
+    inline bool isThreaded() const { return m_thread.isRunning(); }
+    inline uint32_t maxQueue() const { return m_maxQueue; }
+    void setMaxQueue(uint32_t depth);
+    inline uint32_t maxWait() const { return m_maxWait; }
+    inline void setMaxWait(uint32_t timeout) { m_maxWait = timeout; }
+    inline const Statistics &statistics() const { return m_stat; }
+    // Returns count of queued and executing requests
+    inline uint32_t depth() const { return m_pending; }
+    // Returns average service time of request (microsec)
+    inline uint32_t serviceTime() const { return m_serviceTime; }
+    // Returns estimated wait time for new request (millisec)
+    uint32_t estimatedWait() const;
+
+    // Returns `true` if link to downstream device is up (requests are not rejected)
+    bool isReady() const;
+    // Returns `true` if there is queued or executing request
+    inline bool isBusy() const { return m_pending > 0; }
+
+    // Moves client port into dedicated thread. Client port must be created in blocking mode.
+    // `priority` is SCHED_FIFO priority (0 - don't change), `cpu` is CPU affinity (-1 - don't change).
+    // Returns `false` and fills `errorText` if thread can't be created
+    bool start(int priority, int cpu, std::string *errorText);
+    void stop();
+
+    // Executes requests (inline mode) or collects results (dedicated thread mode).
+    // Must be called periodically from the bridge loop
+    void process();
+
+    // Drops request of the `client` (e.g. when upstream connection is closed)
+    void cancelRequest(ModbusObject *client);
+
+public:
+    Modbus::StatusCode readCoils(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t count, void *values);
+    Modbus::StatusCode readDiscreteInputs(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t count, void *values);
+    Modbus::StatusCode readHoldingRegisters(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t count, uint16_t *values);
+    Modbus::StatusCode readInputRegisters(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t count, uint16_t *values);
+    Modbus::StatusCode writeSingleCoil(ModbusObject *client, uint8_t unit, uint16_t offset, bool value);
+    Modbus::StatusCode writeSingleRegister(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t value);
+    Modbus::StatusCode readExceptionStatus(ModbusObject *client, uint8_t unit, uint8_t *value);
+    Modbus::StatusCode diagnostics(ModbusObject *client, uint8_t unit, uint16_t subfunc, uint8_t insize, const uint8_t *indata, uint8_t *outsize, uint8_t *outdata);
+    Modbus::StatusCode getCommEventCounter(ModbusObject *client, uint8_t unit, uint16_t *status, uint16_t *eventCount);
+    Modbus::StatusCode getCommEventLog(ModbusObject *client, uint8_t unit, uint16_t *status, uint16_t *eventCount, uint16_t *messageCount, uint8_t *eventBuffSize, uint8_t *eventBuff);
+    Modbus::StatusCode writeMultipleCoils(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t count, const void *values);
+    Modbus::StatusCode writeMultipleRegisters(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t count, const uint16_t *values);
+    Modbus::StatusCode reportServerID(ModbusObject *client, uint8_t unit, uint8_t *count, uint8_t *data);
+    Modbus::StatusCode maskWriteRegister(ModbusObject *client, uint8_t unit, uint16_t offset, uint16_t andMask, uint16_t orMask);
+    Modbus::StatusCode readWriteMultipleRegisters(ModbusObject *client, uint8_t unit, uint16_t readOffset, uint16_t readCount, uint16_t *readValues, uint16_t writeOffset, uint16_t writeCount, const uint16_t *writeValues);
+    Modbus::StatusCode readFIFOQueue(ModbusObject *client, uint8_t unit, uint16_t fifoadr, uint16_t *count, uint16_t *values);
+
+private:
+    enum
+    {
+        MaxJobs     = 64 ,
+        QueueSize   = 128, // must be power of 2 and greater than `MaxJobs`
+        MaxDataSize = 128  // in 16-bit words, enough for 125 registers or 2000 coils
+    };
+
+    enum JobState
+    {
+        Job_Free,
+        Job_Queued,
+        Job_Done,
+        Job_Canceled
+    };
+
+    struct Job
+    {
+        ModbusObject      *client      ;
+        JobState           state       ;
+        Modbus::StatusCode result      ;
+        uint8_t            func        ;
+        uint8_t            unit        ;
+        uint8_t            inSize      ;
+        uint8_t            outSize     ;
+        uint16_t           offset      ;
+        uint16_t           count       ;
+        uint16_t           writeOffset ;
+        uint16_t           writeCount  ;
+        uint16_t           value       ;
+        uint16_t           orMask      ;
+        uint16_t           status      ;
+        uint16_t           eventCount  ;
+        uint16_t           messageCount;
+        uint32_t           elapsed     ; // service time, microsec
+        uint16_t           rdata[MaxDataSize];
+        uint16_t           wdata[MaxDataSize];
+    };
+
+private:
+    Job *find(ModbusObject *client);
+    Modbus::StatusCode admit(ModbusObject *client, uint8_t func, uint8_t unit, Job **job);
+    bool isPortReady() const;
+    void submit(Job *job);
+    bool isDone(Job *job);
+    Modbus::StatusCode release(Job *job);
+    void complete(Job *job);
+    void collect();
+    void step();
+    Modbus::StatusCode exec(Job *job);
+    static void threadFunc(void *arg);
+    void run();
+
+private:
+    ModbusClientPort *m_clientPort;
+    mClientConnector *m_connector;
+    Job m_jobs[MaxJobs];
+    uint32_t m_pending;
+    uint32_t m_maxQueue;
+    uint32_t m_maxWait;
+    uint32_t m_serviceTime;
+    Statistics m_stat;
+    // inline mode
+    Job *m_current;
+    std::chrono::steady_clock::time_point m_start;
+    // dedicated thread mode
+    mRealtimeThread m_thread;
+    std::atomic<bool> m_run;
+    int m_priority;
+    int m_cpu;
+    mSpscQueue<uint16_t, QueueSize> m_requests;
+    mSpscQueue<uint16_t, QueueSize> m_completions;
+    mPortLog m_log;
+};
+
+#endif // MDOWNSTREAM_H
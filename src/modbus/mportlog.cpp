@@ -0,0 +1,73 @@
+#include "mportlog.h"
+
+#include <cstring>
+
+#include <ModbusClientPort.h>
+#include <ModbusServerPort.h>
+
+mPortLog::mPortLog() : ModbusObject()
+{
+}
+
+void mPortLog::attach(ModbusClientPort *port)
+{
+    port->connect(&ModbusClientPort::signalOpened, this, &mPortLog::slotOpened);
+    port->connect(&ModbusClientPort::signalClosed, this, &mPortLog::slotClosed);
+    port->connect(&ModbusClientPort::signalTx    , this, &mPortLog::slotTx    );
+    port->connect(&ModbusClientPort::signalRx    , this, &mPortLog::slotRx    );
+    port->connect(&ModbusClientPort::signalError , this, &mPortLog::slotError );
+}
+
+void mPortLog::attach(ModbusServerPort *port)
+{
+    port->connect(&ModbusServerPort::signalOpened, this, &mPortLog::slotOpened);
+    port->connect(&ModbusServerPort::signalClosed, this, &mPortLog::slotClosed);
+    port->connect(&ModbusServerPort::signalTx    , this, &mPortLog::slotTx    );
+    port->connect(&ModbusServerPort::signalRx    , this, &mPortLog::slotRx    );
+    port->connect(&ModbusServerPort::signalError , this, &mPortLog::slotError );
+}
+
+void mPortLog::push(Type type, Modbus::StatusCode status, const void *data, size_t size)
+{
+    Record rec;
+    rec.type = type;
+    rec.status = status;
+    if (size >= MaxDataSize)
+        size = MaxDataSize - 1;
+    rec.size = static_cast<uint16_t>(size);
+    if (size)
+        memcpy(rec.data, data, size);
+    rec.data[size] = '\0';
+    // Note: record is lost if main thread does not keep up, port timing is more important
+    m_records.push(rec);
+}
+
+bool mPortLog::pop(Record &rec)
+{
+    return m_records.pop(rec);
+}
+
+void mPortLog::slotOpened(const Modbus::Char * /*source*/)
+{
+    push(Log_Opened, Modbus::Status_Good, nullptr, 0);
+}
+
+void mPortLog::slotClosed(const Modbus::Char * /*source*/)
+{
+    push(Log_Closed, Modbus::Status_Good, nullptr, 0);
+}
+
+void mPortLog::slotTx(const Modbus::Char * /*source*/, const uint8_t *buff, uint16_t size)
+{
+    push(Log_Tx, Modbus::Status_Good, buff, size);
+}
+
+void mPortLog::slotRx(const Modbus::Char * /*source*/, const uint8_t *buff, uint16_t size)
+{
+    push(Log_Rx, Modbus::Status_Good, buff, size);
+}
+
+void mPortLog::slotError(const Modbus::Char * /*source*/, Modbus::StatusCode status, const Modbus::Char *text)
+{
+    push(Log_Error, status, text, strlen(text));
+}
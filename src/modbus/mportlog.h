@@ -0,0 +1,66 @@
+#ifndef MPORTLOG_H
+#define MPORTLOG_H
+
+#include <ModbusObject.h>
+
+#include "mspscqueue.h"
+
+class ModbusClientPort;
+class ModbusServerPort;
+
+/*
+   Deferred log of port signals. Port that works in dedicated (realtime) thread
+   must not print to console, so its signals are queued without allocation
+   and printed later by the main thread (see `pop()`).
+   Records are lost if the main thread does not keep up.
+*/
+class mPortLog : public ModbusObject
+{
+public:
+    enum Type
+    {
+        Log_Opened,
+        Log_Closed,
+        Log_Tx,
+        Log_Rx,
+        Log_Error
+    };
+
+    enum { MaxDataSize = 520 }; // enough for ASCII frame
+
+    struct Record
+    {
+        Type               type  ;
+        Modbus::StatusCode status;
+        uint16_t           size  ;
+        uint8_t            data[MaxDataSize]; // frame for Tx/Rx or null-terminated text for Error
+    };
+
+public:
+    mPortLog();
+
+public:
+    // Connects port signals to the log
+    void attach(ModbusClientPort *port);
+    void attach(ModbusServerPort *port);
+
+    // Producer side (port thread)
+    void push(Type type, Modbus::StatusCode status, const void *data, size_t size);
+    // Consumer side (main thread). Returns `false` if log is empty
+    bool pop(Record &rec);
+
+public: // port slots
+    void slotOpened(const Modbus::Char *source);
+    void slotClosed(const Modbus::Char *source);
+    void slotTx(const Modbus::Char *source, const uint8_t* buff, uint16_t size);
+    void slotRx(const Modbus::Char *source, const uint8_t* buff, uint16_t size);
+    void slotError(const Modbus::Char *source, Modbus::StatusCode status, const Modbus::Char *text);
+
+private:
+    enum { Size = 128 };
+
+private:
+    mSpscQueue<Record, Size> m_records;
+};
+
+#endif // MPORTLOG_H
@@ -0,0 +1,265 @@
+#include "mprefetcher.h"
+
+#include <cstring>
+
+#include "mdownstream.h"
+#include "msharedimage.h"
+
+mPrefetcher::Defaults::Defaults() :
+    maxAge    (200),
+    maxEntries(64 ),
+    minPolls  (3  ),
+    maxLoad   (70 )
+{
+}
+
+const mPrefetcher::Defaults &mPrefetcher::Defaults::instance()
+{
+    static const Defaults d;
+    return d;
+}
+
+static uint16_t dataSize(uint8_t func, uint16_t count)
+{
+    switch (func)
+    {
+    case MBF_READ_COILS:
+    case MBF_READ_DISCRETE_INPUTS:
+        return static_cast<uint16_t>((count + 7) / 8);
+    default:
+        return static_cast<uint16_t>(count * sizeof(uint16_t));
+    }
+}
+
+mPrefetcher::mPrefetcher(mDownstream *downstream) : ModbusObject(),
+    m_downstream(downstream),
+    m_image(nullptr)
+{
+    const Defaults &d = Defaults::instance();
+    setObjectName(m_downstream->objectName());
+    m_maxAge = d.maxAge;
+    m_maxLoad = d.maxLoad;
+    m_maxEntries = d.maxEntries;
+    // Note: reserve memory so pointers to entries stay valid
+    m_entries.reserve(m_maxEntries);
+    memset(&m_stat, 0, sizeof(m_stat));
+    m_current = nullptr;
+    m_generation = 0;
+    m_currentGeneration = 0;
+    m_currentBegin = 0;
+    m_rtt = 0;
+    m_loadTimestamp = Modbus::timer();
+    m_loadBusy = 0;
+    m_loadTotal = 0;
+    m_load = 0;
+}
+
+uint32_t mPrefetcher::hitRate() const
+{
+    uint32_t total = m_stat.hits + m_stat.misses;
+    if (total == 0)
+        return 0;
+    return static_cast<uint32_t>((static_cast<uint64_t>(m_stat.hits) * 100) / total);
+}
+
+bool mPrefetcher::lookup(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count, void *values)
+{
+    uint16_t sz = dataSize(func, count);
+    if ((count == 0) || (sz > sizeof(Entry::data)))
+        return false;
+    Modbus::Timer now = Modbus::timer();
+    Entry *e = learn(func, unit, offset, count, now);
+    if (e && e->ready)
+    {
+        e->ready = false;
+        if ((now - e->timestamp) <= m_maxAge)
+        {
+            memcpy(values, e->data, sz);
+            m_stat.hits++;
+            return true;
+        }
+        m_stat.wasted++;
+    }
+    m_stat.misses++;
+    return false;
+}
+
+void mPrefetcher::forget(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count)
+{
+    Entry *e = find(func, unit, offset, count);
+    if (e)
+        e->polls = 0;
+}
+
+void mPrefetcher::invalidate(uint8_t unit)
+{
+    // Note: prefetch that is in progress now can return value from before write
+    m_generation++;
+    for (Entry &e : m_entries)
+    {
+        if ((unit == 0) || (e.unit == unit)) // 0 - broadcast
+            e.ready = false;
+    }
+}
+
+void mPrefetcher::process()
+{
+    Modbus::Timer now = Modbus::timer();
+    updateLoad(now);
+    if (m_current)
+    {
+        Modbus::StatusCode r = request(m_current, m_buff);
+        if (!Modbus::StatusIsProcessing(r))
+            complete(r);
+        return;
+    }
+    // Note: use only idle bus time and back off when bus is saturated
+    if (!m_downstream->isReady() || m_downstream->isBusy() || (m_load > m_maxLoad))
+        return;
+    Entry *e = nextDue(now);
+    if (e == nullptr)
+        return;
+    e->requested = true;
+    m_current = e;
+    m_currentGeneration = m_generation;
+    m_currentBegin = now;
+    m_stat.prefetches++;
+    Modbus::StatusCode r = request(e, m_buff);
+    if (!Modbus::StatusIsProcessing(r))
+        complete(r);
+}
+
+void mPrefetcher::complete(Modbus::StatusCode status)
+{
+    Modbus::Timer now = Modbus::timer();
+    uint32_t rtt = now - m_currentBegin;
+    m_rtt = m_rtt ? (m_rtt * 3 + rtt) / 4 : rtt;
+    if (Modbus::StatusIsGood(status) && (m_currentGeneration == m_generation))
+    {
+        memcpy(m_current->data, m_buff, dataSize(m_current->func, m_current->count));
+        m_current->timestamp = now;
+        m_current->ready = true;
+        if (m_image)
+            m_image->update(m_current->func, m_current->unit, m_current->offset, m_current->count, m_buff);
+    }
+    else if (Modbus::StatusIsBad(status))
+        m_current->polls = 0; // Note: don't load the bus with requests to failed range, learn it again
+    m_current = nullptr;
+}
+
+mPrefetcher::Entry *mPrefetcher::find(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count)
+{
+    for (Entry &e : m_entries)
+    {
+        if ((e.func == func) && (e.unit == unit) && (e.offset == offset) && (e.count == count))
+            return &e;
+    }
+    return nullptr;
+}
+
+mPrefetcher::Entry *mPrefetcher::learn(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count, Modbus::Timer now)
+{
+    Entry *e = find(func, unit, offset, count);
+    if (e)
+    {
+        uint32_t dt = now - e->lastPoll;
+        e->lastPoll = now;
+        e->requested = false;
+        if (e->period == 0)
+            e->period = dt;
+        else
+        {
+            uint32_t d = (dt > e->period) ? (dt - e->period) : (e->period - dt);
+            e->jitter = (e->jitter * 3 + d) / 4;
+            e->period = (e->period * 3 + dt) / 4;
+        }
+        e->polls++;
+        return e;
+    }
+    if (m_entries.size() < m_maxEntries)
+    {
+        m_entries.push_back(Entry());
+        e = &m_entries.back();
+    }
+    else
+    {
+        // Note: replace entry that was not polled for the longest time
+        for (Entry &i : m_entries)
+        {
+            if ((&i != m_current) && ((e == nullptr) || ((now - i.lastPoll) > (now - e->lastPoll))))
+                e = &i;
+        }
+        if (e == nullptr)
+            return nullptr;
+    }
+    e->func      = func;
+    e->unit      = unit;
+    e->offset    = offset;
+    e->count     = count;
+    e->polls     = 1;
+    e->period    = 0;
+    e->jitter    = 0;
+    e->lastPoll  = now;
+    e->timestamp = 0;
+    e->ready     = false;
+    e->requested = false;
+    return e;
+}
+
+mPrefetcher::Entry *mPrefetcher::nextDue(Modbus::Timer now)
+{
+    const uint32_t minPolls = Defaults::instance().minPolls;
+    // Note: prefetched values must be received not later then half of `maxAge` before poll
+    uint32_t lead = m_rtt + m_maxAge / 2;
+    Entry *res = nullptr;
+    uint32_t resLeft = 0;
+    for (Entry &e : m_entries)
+    {
+        // Note: skip entries with unstable or too short period and entries that were
+        // already prefetched (or failed) in this poll cycle
+        if (e.requested || (e.polls < minPolls) || (e.period <= lead) || (e.jitter > e.period / 4))
+            continue;
+        uint32_t elapsed = now - e.lastPoll;
+        // Note: master stopped polling this range (missed more than one cycle)
+        if (elapsed >= e.period * 2)
+            continue;
+        if (elapsed + lead < e.period)
+            continue;
+        uint32_t left = (elapsed < e.period) ? (e.period - elapsed) : 0;
+        if ((res == nullptr) || (left < resLeft))
+        {
+            res = &e;
+            resLeft = left;
+        }
+    }
+    return res;
+}
+
+Modbus::StatusCode mPrefetcher::request(Entry *e, uint16_t *data)
+{
+    switch (e->func)
+    {
+    case MBF_READ_COILS:
+        return m_downstream->readCoils(this, e->unit, e->offset, e->count, data);
+    case MBF_READ_DISCRETE_INPUTS:
+        return m_downstream->readDiscreteInputs(this, e->unit, e->offset, e->count, data);
+    case MBF_READ_HOLDING_REGISTERS:
+        return m_downstream->readHoldingRegisters(this, e->unit, e->offset, e->count, data);
+    default:
+        return m_downstream->readInputRegisters(this, e->unit, e->offset, e->count, data);
+    }
+}
+
+void mPrefetcher::updateLoad(Modbus::Timer now)
+{
+    if (m_downstream->isBusy())
+        m_loadBusy++;
+    m_loadTotal++;
+    if ((now - m_loadTimestamp) < 1000)
+        return;
+    uint32_t load = (m_loadBusy * 100) / m_loadTotal;
+    m_load = (m_load + load) / 2;
+    m_loadTimestamp = now;
+    m_loadBusy = 0;
+    m_loadTotal = 0;
+}
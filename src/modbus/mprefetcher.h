@@ -0,0 +1,121 @@
+#ifndef MPREFETCHER_H
+#define MPREFETCHER_H
+
+#include <vector>
+
+#include <ModbusObject.h>
+
+class mDownstream;
+class mSharedImage;
+
+/*
+   Learns polling period of every (unit, function, range) read request that
+   passes through `mTcpClient` and issues the same downstream read just before
+   the next expected poll while the bus is idle. Prefetched values are kept
+   until the poll arrives (or become stale after `maxAge` millisec).
+   Prefetching is suspended while downstream bus is saturated.
+   Any write request to the unit invalidates its prefetched values.
+   Range is prefetched at most once per poll cycle, failed read (upstream
+   or prefetch) makes the range unlearned until it's polled again `minPolls` times.
+*/
+class mPrefetcher : public ModbusObject
+{
+public:
+    struct Defaults
+    {
+        const uint32_t maxAge    ;
+        const uint32_t maxEntries;
+        const uint32_t minPolls  ;
+        const uint32_t maxLoad   ; // percent
+
+        Defaults();
+        static const Defaults &instance();
+    };
+
+    struct Statistics
+    {
+        uint32_t hits      ;
+        uint32_t misses    ;
+        uint32_t prefetches;
+        uint32_t wasted    ; // prefetched values that became stale before poll
+    };
+
+public:
+    mPrefetcher(mDownstream *downstream);
+
+public:
+    inline uint32_t maxAge() const { return m_maxAge; }
+    inline void setMaxAge(uint32_t timeout) { m_maxAge = timeout; }
+    inline uint32_t maxLoad() const { return m_maxLoad; }
+    inline void setMaxLoad(uint32_t percent) { m_maxLoad = percent; }
+    inline mSharedImage *sharedImage() const { return m_image; }
+    inline void setSharedImage(mSharedImage *image) { m_image = image; }
+    inline const Statistics &statistics() const { return m_stat; }
+    // Returns estimated downstream bus load in percent
+    inline uint32_t load() const { return m_load; }
+    // Returns hit rate in percent for all read requests
+    uint32_t hitRate() const;
+
+    // Registers upstream read request (`func` is MBF_READ_COILS..MBF_READ_INPUT_REGISTERS).
+    // Returns `true` and fills `values` if request can be answered with prefetched data
+    bool lookup(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count, void *values);
+
+    // Registers failed upstream read request, so its range is not prefetched
+    void forget(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count);
+
+    // Discards prefetched data for `unit` and any prefetch that is in progress
+    void invalidate(uint8_t unit);
+
+    // Issues prefetch requests. Must be called periodically from the main loop
+    void process();
+
+private:
+    enum { MaxDataSize = 128 }; // in 16-bit words, enough for 125 registers or 2000 coils
+
+    struct Entry
+    {
+        uint8_t       func      ;
+        uint8_t       unit      ;
+        uint16_t      offset    ;
+        uint16_t      count     ;
+        uint32_t      polls     ;
+        uint32_t      period    ;
+        uint32_t      jitter    ;
+        Modbus::Timer lastPoll  ;
+        Modbus::Timer timestamp ; // time when prefetched data was received
+        bool          ready     ;
+        bool          requested ; // prefetch was issued since the last poll
+        uint16_t      data[MaxDataSize];
+    };
+
+private:
+    Entry *find(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count);
+    Entry *learn(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count, Modbus::Timer now);
+    Entry *nextDue(Modbus::Timer now);
+    Modbus::StatusCode request(Entry *e, uint16_t *data);
+    void complete(Modbus::StatusCode status);
+    void updateLoad(Modbus::Timer now);
+
+private:
+    mDownstream *m_downstream;
+    mSharedImage *m_image;
+    uint32_t m_maxAge;
+    uint32_t m_maxLoad;
+    uint32_t m_maxEntries;
+    std::vector<Entry> m_entries;
+    Statistics m_stat;
+    // current prefetch
+    Entry *m_current;
+    uint32_t m_generation;
+    uint32_t m_currentGeneration;
+    Modbus::Timer m_currentBegin;
+    uint32_t m_rtt;
+    uint16_t m_buff[MaxDataSize];
+    // bus load estimation
+    Modbus::Timer m_loadTimestamp;
+    uint32_t m_loadBusy;
+    uint32_t m_loadTotal;
+    uint32_t m_load;
+};
+
+#endif // MPREFETCHER_H
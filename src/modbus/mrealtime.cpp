@@ -0,0 +1,151 @@
+#include "mrealtime.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+bool mRealtime::setCurrentThread(int priority, int cpu, std::string *errorText)
+{
+#ifdef _WIN32
+    if ((priority > 0) && !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+    {
+        *errorText = "SetThreadPriority() failed";
+        return false;
+    }
+    if ((cpu >= 0) && !SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu))
+    {
+        *errorText = "SetThreadAffinityMask() failed";
+        return false;
+    }
+    return true;
+#else
+    int r;
+    if (priority > 0)
+    {
+        sched_param sp;
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = priority;
+        r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+        if (r != 0)
+        {
+            *errorText = std::string("pthread_setschedparam(SCHED_FIFO) failed: ") + strerror(r);
+            return false;
+        }
+    }
+    if (cpu >= 0)
+    {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (r != 0)
+        {
+            *errorText = std::string("pthread_setaffinity_np() failed: ") + strerror(r);
+            return false;
+        }
+#else
+        *errorText = "CPU affinity is not supported on this platform";
+        return false;
+#endif
+    }
+    return true;
+#endif
+}
+
+bool mRealtime::lockMemory(std::string *errorText)
+{
+#ifdef _WIN32
+    *errorText = "Memory locking is not supported on Windows";
+    return false;
+#else
+    // Note: with finite limit MCL_FUTURE makes heap growth and new threads fail
+    // with ENOMEM/EAGAIN once limit is reached, so only current memory is locked
+    int flags = MCL_CURRENT;
+    struct rlimit rl;
+    if ((geteuid() == 0) || ((getrlimit(RLIMIT_MEMLOCK, &rl) == 0) && (rl.rlim_cur == RLIM_INFINITY)))
+        flags |= MCL_FUTURE;
+    if (mlockall(flags) != 0)
+    {
+        int err = errno;
+        // Note: undo partial locking, including MCL_FUTURE
+        munlockall();
+        *errorText = std::string("mlockall() failed: ") + strerror(err);
+        return false;
+    }
+    return true;
+#endif
+}
+
+mRealtimeThread::mRealtimeThread() :
+    m_running(false),
+    m_func(nullptr),
+    m_arg(nullptr)
+{
+}
+
+mRealtimeThread::~mRealtimeThread()
+{
+    join();
+}
+
+bool mRealtimeThread::start(Function func, void *arg, std::string *errorText, size_t stackSize)
+{
+    if (m_running)
+        return true;
+    m_func = func;
+    m_arg = arg;
+#ifdef _WIN32
+    m_handle = CreateThread(nullptr, stackSize, threadFunc, this, STACK_SIZE_PARAM_IS_A_RESERVATION, nullptr);
+    if (m_handle == nullptr)
+    {
+        *errorText = "CreateThread() failed";
+        return false;
+    }
+#else
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (stackSize < static_cast<size_t>(PTHREAD_STACK_MIN))
+        stackSize = static_cast<size_t>(PTHREAD_STACK_MIN);
+    pthread_attr_setstacksize(&attr, stackSize);
+    int r = pthread_create(&m_thread, &attr, threadFunc, this);
+    pthread_attr_destroy(&attr);
+    if (r != 0)
+    {
+        *errorText = std::string("pthread_create() failed: ") + strerror(r);
+        return false;
+    }
+#endif
+    m_running = true;
+    return true;
+}
+
+void mRealtimeThread::join()
+{
+    if (!m_running)
+        return;
+#ifdef _WIN32
+    WaitForSingleObject(m_handle, INFINITE);
+    CloseHandle(m_handle);
+#else
+    pthread_join(m_thread, nullptr);
+#endif
+    m_running = false;
+}
+
+#ifdef _WIN32
+DWORD WINAPI mRealtimeThread::threadFunc(LPVOID param)
+#else
+void *mRealtimeThread::threadFunc(void *param)
+#endif
+{
+    mRealtimeThread *t = static_cast<mRealtimeThread*>(param);
+    t->m_func(t->m_arg);
+    return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef MREALTIME_H
+#define MREALTIME_H
+
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/*
+   Realtime helpers for threads that handle serial port timing.
+*/
+class mRealtime
+{
+public:
+    // Sets realtime (SCHED_FIFO) `priority` (0 - don't change) and CPU affinity to `cpu`
+    // (-1 - don't change) for the calling thread. Returns `false` and fills `errorText` on error
+    static bool setCurrentThread(int priority, int cpu, std::string *errorText);
+
+    // Locks process memory in RAM to avoid page faults. Future allocations are locked too
+    // only if locked memory is not limited (RLIMIT_MEMLOCK), otherwise they could fail later.
+    // Must be called after all threads are started (see `mRealtimeThread`)
+    static bool lockMemory(std::string *errorText);
+};
+
+/*
+   Thread with explicit (small) stack size. Default stack of `std::thread`
+   (8 MB on Linux) can't be created when memory is locked with finite
+   RLIMIT_MEMLOCK and it wastes locked memory anyway.
+*/
+class mRealtimeThread
+{
+public:
+    typedef void (*Function)(void *arg);
+
+    enum { DefaultStackSize = 256 * 1024 };
+
+public:
+    mRealtimeThread();
+    ~mRealtimeThread();
+
+public:
+    inline bool isRunning() const { return m_running; }
+
+    // Starts `func(arg)` in new thread. Returns `false` and fills `errorText` on error
+    bool start(Function func, void *arg, std::string *errorText, size_t stackSize = DefaultStackSize);
+    // Waits for thread function to return
+    void join();
+
+private:
+#ifdef _WIN32
+    static DWORD WINAPI threadFunc(LPVOID param);
+#else
+    static void *threadFunc(void *param);
+#endif
+
+private:
+#ifdef _WIN32
+    HANDLE m_handle;
+#else
+    pthread_t m_thread;
+#endif
+    bool m_running;
+    Function m_func;
+    void *m_arg;
+};
+
+#endif // MREALTIME_H
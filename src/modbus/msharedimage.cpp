@@ -0,0 +1,249 @@
+#include "msharedimage.h"
+
+#include <chrono>
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static_assert(sizeof(mSharedImage::Header) == 32, "mSharedImage::Header layout is changed");
+static_assert(sizeof(mSharedImage::Block) == 280, "mSharedImage::Block layout is changed");
+
+mSharedImage::Defaults::Defaults() :
+    name    ("/mbridge"),
+    capacity(1024)
+{
+}
+
+const mSharedImage::Defaults &mSharedImage::Defaults::instance()
+{
+    static const Defaults d;
+    return d;
+}
+
+bool mSharedImage::readBlock(const Block *block, Block *out)
+{
+    uint32_t seq = block->seq.load(std::memory_order_acquire);
+    if (seq & 1)
+        return false;
+    // Note: copy fields except `seq`
+    memcpy(reinterpret_cast<char*>(out) + sizeof(out->seq),
+           reinterpret_cast<const char*>(block) + sizeof(block->seq),
+           sizeof(Block) - sizeof(block->seq));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (block->seq.load(std::memory_order_relaxed) != seq)
+        return false;
+    out->seq.store(seq, std::memory_order_relaxed);
+    return true;
+}
+
+mSharedImage::mSharedImage()
+{
+    const Defaults &d = Defaults::instance();
+    m_name = d.name;
+    m_capacity = d.capacity;
+    m_size = 0;
+    m_fd = -1;
+    m_header = nullptr;
+    m_blocks = nullptr;
+    m_indexMask = 0;
+}
+
+mSharedImage::~mSharedImage()
+{
+    close();
+}
+
+bool mSharedImage::open()
+{
+#ifdef _WIN32
+    m_lastErrorText = "Shared memory image is not supported on Windows";
+    return false;
+#else
+    if (isOpen())
+        return true;
+    // Note: POSIX shared memory object name must start with '/'
+    if (m_name.empty() || (m_name[0] != '/'))
+        m_name.insert(0, 1, '/');
+    if (!removeStale())
+        return false;
+    m_size = sizeof(Header) + static_cast<size_t>(m_capacity) * sizeof(Block);
+    int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        if (errno == EEXIST)
+            m_lastErrorText = "segment is used by another process";
+        else
+            m_lastErrorText = std::string("shm_open() failed: ") + strerror(errno);
+        return false;
+    }
+    // Note: lock is held while segment is open, it's released by OS if process crashes
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        m_lastErrorText = "segment is used by another process";
+        ::close(fd);
+        return false;
+    }
+    if (ftruncate(fd, static_cast<off_t>(m_size)) != 0)
+    {
+        m_lastErrorText = std::string("ftruncate() failed: ") + strerror(errno);
+        shm_unlink(m_name.c_str());
+        ::close(fd);
+        return false;
+    }
+    void *p = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        m_lastErrorText = std::string("mmap() failed: ") + strerror(errno);
+        shm_unlink(m_name.c_str());
+        ::close(fd);
+        return false;
+    }
+    m_fd = fd;
+    memset(p, 0, m_size);
+    m_header = static_cast<Header*>(p);
+    m_blocks = reinterpret_cast<Block*>(static_cast<char*>(p) + sizeof(Header));
+    m_header->version    = Version;
+    m_header->headerSize = sizeof(Header);
+    m_header->blockSize  = sizeof(Block);
+    m_header->capacity   = m_capacity;
+    m_header->pid        = static_cast<uint32_t>(getpid());
+    m_header->count.store(0, std::memory_order_relaxed);
+    m_header->state.store(State_Alive, std::memory_order_relaxed);
+    // Note: magic is written last so reader can check that segment is initialized
+    std::atomic_thread_fence(std::memory_order_release);
+    m_header->magic      = Magic;
+    // Note: table is at least twice bigger than capacity, so it always has empty slot
+    uint32_t size = 1;
+    while (size < m_capacity * 2)
+        size <<= 1;
+    m_index.assign(size, 0);
+    m_indexMask = size - 1;
+    return true;
+#endif
+}
+
+void mSharedImage::close()
+{
+#ifndef _WIN32
+    if (!isOpen())
+        return;
+    // Note: readers that mapped segment keep their mapping until they unmap it,
+    // closed state tells them that values are not updated anymore
+    m_header->state.store(State_Closed, std::memory_order_release);
+    munmap(m_header, m_size);
+    shm_unlink(m_name.c_str());
+    ::close(m_fd); // releases lock
+    m_fd = -1;
+    m_header = nullptr;
+    m_blocks = nullptr;
+    m_index.clear();
+    m_indexMask = 0;
+#endif
+}
+
+bool mSharedImage::removeStale()
+{
+#ifndef _WIN32
+    int fd = shm_open(m_name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        return true; // Note: segment doesn't exist, nothing to remove
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        m_lastErrorText = "segment is used by another process";
+        ::close(fd);
+        return false;
+    }
+    struct stat st;
+    void *p = MAP_FAILED;
+    if ((fstat(fd, &st) == 0) && (st.st_size >= static_cast<off_t>(sizeof(Header))))
+        p = mmap(nullptr, sizeof(Header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        m_lastErrorText = "segment exists and it's not mbridge image";
+        ::close(fd);
+        return false;
+    }
+    Header *h = static_cast<Header*>(p);
+    bool image = (h->magic == Magic);
+    // Note: segment was left by crashed publisher, tell its readers to reopen it
+    if (image)
+        h->state.store(State_Closed, std::memory_order_release);
+    munmap(p, sizeof(Header));
+    if (!image)
+    {
+        m_lastErrorText = "segment exists and it's not mbridge image";
+        ::close(fd);
+        return false;
+    }
+    shm_unlink(m_name.c_str());
+    ::close(fd);
+#endif
+    return true;
+}
+
+uint32_t *mSharedImage::findSlot(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count)
+{
+    uint64_t key = (static_cast<uint64_t>(func) << 48) | (static_cast<uint64_t>(unit) << 32) | (static_cast<uint64_t>(offset) << 16) | count;
+    uint32_t i = static_cast<uint32_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & m_indexMask;
+    while (m_index[i])
+    {
+        const Block *b = &m_blocks[m_index[i] - 1];
+        if ((b->func == func) && (b->unit == unit) && (b->offset == offset) && (b->count == count))
+            break;
+        i = (i + 1) & m_indexMask;
+    }
+    return &m_index[i];
+}
+
+void mSharedImage::update(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count, const void *values)
+{
+    if (!isOpen())
+        return;
+    size_t sz;
+    switch (func)
+    {
+    case MBF_READ_COILS:
+    case MBF_READ_DISCRETE_INPUTS:
+        sz = (count + 7) / 8;
+        break;
+    default:
+        sz = count * sizeof(uint16_t);
+        break;
+    }
+    if ((count == 0) || (sz > sizeof(Block::data)))
+        return;
+    uint32_t *slot = findSlot(func, unit, offset, count);
+    Block *b;
+    bool added = false;
+    if (*slot)
+        b = &m_blocks[*slot - 1];
+    else
+    {
+        uint32_t i = m_header->count.load(std::memory_order_relaxed);
+        if (i >= m_capacity) // Note: image is full, range is not published
+            return;
+        *slot = i + 1;
+        b = &m_blocks[i];
+        added = true;
+    }
+    uint32_t seq = b->seq.load(std::memory_order_relaxed);
+    b->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    b->func      = func;
+    b->unit      = unit;
+    b->offset    = offset;
+    b->count     = count;
+    b->updates++;
+    b->timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    memcpy(b->data, values, sz);
+    b->seq.store(seq + 2, std::memory_order_release);
+    if (added)
+        m_header->count.fetch_add(1, std::memory_order_release);
+}
@@ -0,0 +1,128 @@
+#ifndef MSHAREDIMAGE_H
+#define MSHAREDIMAGE_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <ModbusGlobal.h>
+
+/*
+   Publishes the latest values of every register and coil range read from
+   downstream devices into POSIX shared memory segment, so local processes
+   can map it and read values without syscalls or Modbus traffic.
+
+   Layout (version 1), all fields are in host byte order:
+
+       Header                      (32 bytes)
+       Block[Header::capacity]     (Header::blockSize bytes each)
+
+   Every block holds one read range (unit, function, offset, count). Blocks are
+   never moved or reused, `Header::count` is increased (release) after a new
+   block is filled. Block is protected by seqlock: `seq` is odd while writer
+   updates the block, so reader must copy block and retry if `seq` was odd or
+   changed meanwhile (see `mSharedImage::readBlock()`). Coils and discrete
+   inputs are bit-packed like in Modbus PDU (first item in LSB of first byte).
+   Write requests are not reflected in image until the next read of the range.
+
+   Segment is owned by one publisher: it holds `flock()` on the segment while it
+   runs, so another instance with the same name fails to open it. `Header::state`
+   is `State_Alive` while publisher runs and becomes `State_Closed` when segment
+   is closed and unlinked, `Header::pid` lets reader detect crashed publisher.
+   Reader that sees closed state or dead publisher must unmap segment and
+   reopen it by name instead of reading frozen values.
+*/
+class mSharedImage
+{
+public:
+    enum
+    {
+        Magic       = 0x4853424D, // 'MBSH'
+        Version     = 1,
+        MaxDataSize = 128         // in 16-bit words, enough for 125 registers or 2000 coils
+    };
+
+    enum State
+    {
+        State_Closed = 0,
+        State_Alive  = 1
+    };
+
+    struct Header
+    {
+        uint32_t              magic    ;
+        uint16_t              version  ;
+        uint16_t              headerSize;
+        uint32_t              blockSize;
+        uint32_t              capacity ;
+        std::atomic<uint32_t> count    ; // number of used blocks
+        std::atomic<uint32_t> state    ; // State_Alive or State_Closed
+        uint32_t              pid      ; // process id of publisher
+        uint32_t              reserved ;
+    };
+
+    struct Block
+    {
+        std::atomic<uint32_t> seq      ;
+        uint8_t               func     ; // MBF_READ_COILS..MBF_READ_INPUT_REGISTERS
+        uint8_t               unit     ;
+        uint16_t              offset   ;
+        uint16_t              count    ;
+        uint16_t              reserved ;
+        uint32_t              updates  ; // number of updates of this block
+        uint64_t              timestamp; // millisec since epoch of the last update
+        uint16_t              data[MaxDataSize];
+    };
+
+    struct Defaults
+    {
+        const Modbus::Char *name    ;
+        const uint32_t      capacity;
+
+        Defaults();
+        static const Defaults &instance();
+    };
+
+public:
+    // Makes consistent copy of `block` into `out`. Returns `false` if writer is busy and reader must retry.
+    static bool readBlock(const Block *block, Block *out);
+
+public:
+    mSharedImage();
+    ~mSharedImage();
+
+public:
+    inline const Modbus::Char *name() const { return m_name.c_str(); }
+    inline void setName(const Modbus::Char *name) { m_name = name; }
+    inline uint32_t capacity() const { return m_capacity; }
+    inline void setCapacity(uint32_t capacity) { m_capacity = capacity; }
+    inline bool isOpen() const { return m_header != nullptr; }
+    inline const Modbus::Char *lastErrorText() const { return m_lastErrorText.c_str(); }
+
+    // Creates shared memory segment. Segment left by crashed publisher is replaced,
+    // segment of running publisher is not touched. Returns `false` on error (see `lastErrorText()`)
+    bool open();
+    void close();
+
+    // Publishes values of the read range (`func` is MBF_READ_COILS..MBF_READ_INPUT_REGISTERS)
+    void update(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count, const void *values);
+
+private:
+    bool removeStale();
+    uint32_t *findSlot(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count);
+
+private:
+    std::string m_name;
+    uint32_t m_capacity;
+    std::string m_lastErrorText;
+    size_t m_size;
+    int m_fd;
+    Header *m_header;
+    Block *m_blocks;
+    // Note: open-addressed hash table of block index + 1 (0 - empty slot), it's allocated
+    // by `open()` so `update()` doesn't allocate memory in the (realtime) bridge loop
+    std::vector<uint32_t> m_index;
+    uint32_t m_indexMask;
+};
+
+#endif // MSHAREDIMAGE_H
@@ -0,0 +1,54 @@
+#ifndef MSPSCQUEUE_H
+#define MSPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+/*
+   Lock-free bounded queue for single producer and single consumer thread.
+   `Size` must be power of 2, queue can hold `Size-1` items.
+*/
+template <class T, size_t Size>
+class mSpscQueue
+{
+    static_assert((Size >= 2) && ((Size & (Size - 1)) == 0), "mSpscQueue size must be power of 2");
+
+public:
+    mSpscQueue() : m_head(0), m_tail(0) {}
+
+public:
+    // Producer side. Returns `false` if queue is full
+    bool push(const T &item)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) & (Size - 1);
+        if (next == m_head.load(std::memory_order_acquire))
+            return false;
+        m_items[tail] = item;
+        m_tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns `false` if queue is empty
+    bool pop(T &item)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+        item = m_items[head];
+        m_head.store((head + 1) & (Size - 1), std::memory_order_release);
+        return true;
+    }
+
+    inline bool isEmpty() const { return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire); }
+
+private:
+    T m_items[Size];
+    // Note: padding keeps producer and consumer index in separate cache lines
+    char m_pad0[64];
+    std::atomic<size_t> m_head;
+    char m_pad1[64];
+    std::atomic<size_t> m_tail;
+};
+
+#endif // MSPSCQUEUE_H
@@ -2,8 +2,10 @@
 
 #include "mtcpclient.h"
 
-mTcpBridge::mTcpBridge(ModbusClientPort *clientPort) : ModbusTcpServer(static_cast<ModbusInterface*>(nullptr)),
-    m_clientPort(clientPort)
+mTcpBridge::mTcpBridge(mDownstream *downstream) : ModbusTcpServer(static_cast<ModbusInterface*>(nullptr)),
+    m_downstream(downstream),
+    m_prefetcher(nullptr),
+    m_image(nullptr)
 {
 }
 
@@ -17,7 +19,9 @@ mTcpBridge::~mTcpBridge()
 ModbusServerPort *mTcpBridge::createTcpPort(ModbusTcpSocket *socket)
 {
     ModbusServerPort *p = ModbusTcpServer::createTcpPort(socket);
-    mTcpClient *c = new mTcpClient(m_clientPort);
+    mTcpClient *c = new mTcpClient(m_downstream);
+    c->setPrefetcher(m_prefetcher);
+    c->setSharedImage(m_image);
     p->setDevice(c);
     return p;
 }
@@ -3,20 +3,31 @@
 
 #include <ModbusTcpServer.h>
 
-class ModbusClientPort;
+class mDownstream;
+class mPrefetcher;
+class mSharedImage;
 
 class mTcpBridge : public ModbusTcpServer
 {
 public:
-    mTcpBridge(ModbusClientPort *clientPort);
+    mTcpBridge(mDownstream *downstream);
     ~mTcpBridge();
-    
+
+public:
+    inline mDownstream *downstream() const { return m_downstream; }
+    inline mPrefetcher *prefetcher() const { return m_prefetcher; }
+    inline void setPrefetcher(mPrefetcher *prefetcher) { m_prefetcher = prefetcher; }
+    inline mSharedImage *sharedImage() const { return m_image; }
+    inline void setSharedImage(mSharedImage *image) { m_image = image; }
+
 public:
     ModbusServerPort *createTcpPort(ModbusTcpSocket *socket) override;
     void deleteTcpPort(ModbusServerPort *port) override;
 
 private:
-    ModbusClientPort *m_clientPort;
+    mDownstream *m_downstream;
+    mPrefetcher *m_prefetcher;
+    mSharedImage *m_image;
 };
 
 #endif // MTCPBRIDGE_H
\ No newline at end of file
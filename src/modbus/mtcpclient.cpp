@@ -1,89 +1,166 @@
 #include "mtcpclient.h"
 
-#include <ModbusClientPort.h>
+#include "mdownstream.h"
+#include "mprefetcher.h"
+#include "msharedimage.h"
 
-mTcpClient::mTcpClient(ModbusClientPort *clientPort) : ModbusObject(),
-    m_clientPort(clientPort)
+mTcpClient::mTcpClient(mDownstream *downstream) : ModbusObject(),
+    m_downstream(downstream),
+    m_prefetcher(nullptr),
+    m_image(nullptr),
+    m_processing(false)
 {
-    setObjectName(m_clientPort->objectName());
+    setObjectName(m_downstream->objectName());
+}
+
+mTcpClient::~mTcpClient()
+{
+    m_downstream->cancelRequest(this);
+}
+
+bool mTcpClient::isPrefetched(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count, void *values)
+{
+    // Note: register request in prefetcher only once, not for every repeated call while it's processing
+    return (m_prefetcher != nullptr) && !m_processing && m_prefetcher->lookup(func, unit, offset, count, values);
+}
+
+void mTcpClient::forgetPrefetched(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count)
+{
+    if (m_prefetcher)
+        m_prefetcher->forget(func, unit, offset, count);
+}
+
+void mTcpClient::invalidatePrefetched(uint8_t unit)
+{
+    if (m_prefetcher)
+        m_prefetcher->invalidate(unit);
+}
+
+void mTcpClient::publish(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count, const void *values)
+{
+    if (m_image)
+        m_image->update(func, unit, offset, count, values);
+}
+
+Modbus::StatusCode mTcpClient::trackStatus(Modbus::StatusCode status)
+{
+    m_processing = Modbus::StatusIsProcessing(status);
+    return status;
 }
 
 Modbus::StatusCode mTcpClient::readCoils(uint8_t unit, uint16_t offset, uint16_t count, void *values)
 {
-    return m_clientPort->readCoils(this, unit, offset, count, values);
+    if (isPrefetched(MBF_READ_COILS, unit, offset, count, values))
+        return Modbus::Status_Good;
+    Modbus::StatusCode r = trackStatus(m_downstream->readCoils(this, unit, offset, count, values));
+    if (Modbus::StatusIsGood(r))
+        publish(MBF_READ_COILS, unit, offset, count, values);
+    else if (Modbus::StatusIsBad(r))
+        forgetPrefetched(MBF_READ_COILS, unit, offset, count);
+    return r;
 }
 
 Modbus::StatusCode mTcpClient::readDiscreteInputs(uint8_t unit, uint16_t offset, uint16_t count, void *values)
 {
-    return m_clientPort->readDiscreteInputs(this, unit, offset, count, values);
+    if (isPrefetched(MBF_READ_DISCRETE_INPUTS, unit, offset, count, values))
+        return Modbus::Status_Good;
+    Modbus::StatusCode r = trackStatus(m_downstream->readDiscreteInputs(this, unit, offset, count, values));
+    if (Modbus::StatusIsGood(r))
+        publish(MBF_READ_DISCRETE_INPUTS, unit, offset, count, values);
+    else if (Modbus::StatusIsBad(r))
+        forgetPrefetched(MBF_READ_DISCRETE_INPUTS, unit, offset, count);
+    return r;
 }
 
 Modbus::StatusCode mTcpClient::readHoldingRegisters(uint8_t unit, uint16_t offset, uint16_t count, uint16_t *values)
 {
-    return m_clientPort->readHoldingRegisters(this, unit, offset, count, values);
+    if (isPrefetched(MBF_READ_HOLDING_REGISTERS, unit, offset, count, values))
+        return Modbus::Status_Good;
+    Modbus::StatusCode r = trackStatus(m_downstream->readHoldingRegisters(this, unit, offset, count, values));
+    if (Modbus::StatusIsGood(r))
+        publish(MBF_READ_HOLDING_REGISTERS, unit, offset, count, values);
+    else if (Modbus::StatusIsBad(r))
+        forgetPrefetched(MBF_READ_HOLDING_REGISTERS, unit, offset, count);
+    return r;
 }
 
 Modbus::StatusCode mTcpClient::readInputRegisters(uint8_t unit, uint16_t offset, uint16_t count, uint16_t *values)
 {
-    return m_clientPort->readInputRegisters(this, unit, offset, count, values);
+    if (isPrefetched(MBF_READ_INPUT_REGISTERS, unit, offset, count, values))
+        return Modbus::Status_Good;
+    Modbus::StatusCode r = trackStatus(m_downstream->readInputRegisters(this, unit, offset, count, values));
+    if (Modbus::StatusIsGood(r))
+        publish(MBF_READ_INPUT_REGISTERS, unit, offset, count, values);
+    else if (Modbus::StatusIsBad(r))
+        forgetPrefetched(MBF_READ_INPUT_REGISTERS, unit, offset, count);
+    return r;
 }
 
 Modbus::StatusCode mTcpClient::writeSingleCoil(uint8_t unit, uint16_t offset, bool value)
 {
-    return m_clientPort->writeSingleCoil(this, unit, offset, value);
+    invalidatePrefetched(unit);
+    return m_downstream->writeSingleCoil(this, unit, offset, value);
 }
 
 Modbus::StatusCode mTcpClient::writeSingleRegister(uint8_t unit, uint16_t offset, uint16_t value)
 {
-    return m_clientPort->writeSingleRegister(this, unit, offset, value);
+    invalidatePrefetched(unit);
+    return m_downstream->writeSingleRegister(this, unit, offset, value);
 }
 
 Modbus::StatusCode mTcpClient::readExceptionStatus(uint8_t unit, uint8_t *status)
 {
-    return m_clientPort->readExceptionStatus(this, unit, status);
+    return m_downstream->readExceptionStatus(this, unit, status);
 }
 
 Modbus::StatusCode mTcpClient::diagnostics(uint8_t unit, uint16_t subfunc, uint8_t insize, const uint8_t *indata, uint8_t *outsize, uint8_t *outdata)
 {
-    return m_clientPort->diagnostics(this, unit, subfunc, insize, indata, outsize, outdata);
+    return m_downstream->diagnostics(this, unit, subfunc, insize, indata, outsize, outdata);
 }
 
 Modbus::StatusCode mTcpClient::getCommEventCounter(uint8_t unit, uint16_t *status, uint16_t *eventCount)
 {
-    return m_clientPort->getCommEventCounter(this, unit, status, eventCount);
+    return m_downstream->getCommEventCounter(this, unit, status, eventCount);
 }
 
 Modbus::StatusCode mTcpClient::getCommEventLog(uint8_t unit, uint16_t *status, uint16_t *eventCount, uint16_t *messageCount, uint8_t *eventBuffSize, uint8_t *eventBuff)
 {
-    return m_clientPort->getCommEventLog(this, unit, status, eventCount, messageCount, eventBuffSize, eventBuff);
+    return m_downstream->getCommEventLog(this, unit, status, eventCount, messageCount, eventBuffSize, eventBuff);
 }
 
 Modbus::StatusCode mTcpClient::writeMultipleCoils(uint8_t unit, uint16_t offset, uint16_t count, const void *values)
 {
-    return m_clientPort->writeMultipleCoils(this, unit, offset, count, values);
+    invalidatePrefetched(unit);
+    return m_downstream->writeMultipleCoils(this, unit, offset, count, values);
 }
 
 Modbus::StatusCode mTcpClient::writeMultipleRegisters(uint8_t unit, uint16_t offset, uint16_t count, const uint16_t *values)
 {
-    return m_clientPort->writeMultipleRegisters(this, unit, offset, count, values);
+    invalidatePrefetched(unit);
+    return m_downstream->writeMultipleRegisters(this, unit, offset, count, values);
 }
 
 Modbus::StatusCode mTcpClient::reportServerID(uint8_t unit, uint8_t *count, uint8_t *data)
 {
-    return m_clientPort->reportServerID(this, unit, count, data);
+    return m_downstream->reportServerID(this, unit, count, data);
 }
 
 Modbus::StatusCode mTcpClient::maskWriteRegister(uint8_t unit, uint16_t offset, uint16_t andMask, uint16_t orMask)
 {
-    return m_clientPort->maskWriteRegister(this, unit, offset, andMask, orMask);
+    invalidatePrefetched(unit);
+    return m_downstream->maskWriteRegister(this, unit, offset, andMask, orMask);
 }
 
 Modbus::StatusCode mTcpClient::readWriteMultipleRegisters(uint8_t unit, uint16_t readOffset, uint16_t readCount, uint16_t *readValues, uint16_t writeOffset, uint16_t writeCount, const uint16_t *writeValues)
 {
-    return m_clientPort->readWriteMultipleRegisters(this, unit, readOffset, readCount, readValues, writeOffset, writeCount, writeValues);
+    invalidatePrefetched(unit);
+    Modbus::StatusCode r = m_downstream->readWriteMultipleRegisters(this, unit, readOffset, readCount, readValues, writeOffset, writeCount, writeValues);
+    if (Modbus::StatusIsGood(r))
+        publish(MBF_READ_HOLDING_REGISTERS, unit, readOffset, readCount, readValues);
+    return r;
 }
 
 Modbus::StatusCode mTcpClient::readFIFOQueue(uint8_t unit, uint16_t fifoadr, uint16_t *count, uint16_t *values)
 {
-    return m_clientPort->readFIFOQueue(this, unit, fifoadr, count, values);
+    return m_downstream->readFIFOQueue(this, unit, fifoadr, count, values);
 }
@@ -3,12 +3,22 @@
 
 #include <ModbusObject.h>
 
-class ModbusClientPort;
+class mDownstream;
+class mPrefetcher;
+class mSharedImage;
 
 class mTcpClient : public ModbusObject, public ModbusInterface
 {
 public:
-    mTcpClient(ModbusClientPort *m_clientPort);
+    mTcpClient(mDownstream *downstream);
+    ~mTcpClient();
+
+public:
+    inline mDownstream *downstream() const { return m_downstream; }
+    inline mPrefetcher *prefetcher() const { return m_prefetcher; }
+    inline void setPrefetcher(mPrefetcher *prefetcher) { m_prefetcher = prefetcher; }
+    inline mSharedImage *sharedImage() const { return m_image; }
+    inline void setSharedImage(mSharedImage *image) { m_image = image; }
 
 public:
     Modbus::StatusCode readCoils(uint8_t unit, uint16_t offset, uint16_t count, void *values) override;
@@ -29,7 +39,17 @@ public:
     Modbus::StatusCode readFIFOQueue(uint8_t unit, uint16_t fifoadr, uint16_t *count, uint16_t *values) override;
 
 private:
-    ModbusClientPort *m_clientPort;
+    bool isPrefetched(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count, void *values);
+    void forgetPrefetched(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count);
+    void invalidatePrefetched(uint8_t unit);
+    void publish(uint8_t func, uint8_t unit, uint16_t offset, uint16_t count, const void *values);
+    Modbus::StatusCode trackStatus(Modbus::StatusCode status);
+
+private:
+    mDownstream *m_downstream;
+    mPrefetcher *m_prefetcher;
+    mSharedImage *m_image;
+    bool m_processing;
 };
 
 #endif // MTCPCLIENT_H
\ No newline at end of file